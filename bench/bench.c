@@ -0,0 +1,459 @@
+// benchmark driver for lvm and lasm
+//
+// build from the repository root with
+//	cc -O2 -DLASM_NO_MAIN -DLVM_NO_MAIN -o lbench bench/bench.c lasm.c lvm.c
+// and run with
+//	lbench [-O] [-jit] [-runs n] [-lib stdlib.lasm] [-save baseline] [-compare baseline] [-tolerance percent] workloads...
+//
+// every workload is assembled after the library (stdlib.lasm unless -lib is given) and measured in a child process of
+// its own, so the peak resident set size is that of the workload alone
+
+#include "../lasm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* amount of timed runs of every workload (the fastest one counts) */
+#define BENCH_RUNS			5
+
+/* assembly is repeated until it took at least this long in total (seconds) */
+#define BENCH_ASM_SECONDS	0.5
+
+/* allowed slowdown (or growth of the peak resident set size) against the baseline before it counts as a regression,
+ * in percent */
+#define BENCH_TOLERANCE		10.0
+
+/* maximum length of a workload name */
+#define BENCH_NAME_LENGTH	0x40
+
+// measurements of a workload
+typedef struct bench_result
+{
+	char name[BENCH_NAME_LENGTH];	// name of the workload (file name without directory and extension)
+	unsigned long long instrs;		// amount of instructions one run executes
+	long long result;				// value the program halts with
+	double seconds;					// wall time of the fastest run
+	long rss;						// peak resident set size in kilobytes
+	double asm_rate;				// assembly throughput in bytes of source per second
+} bench_result_t;
+
+// settings shared by every workload
+typedef struct bench_options
+{
+	int optimize;					// whether to assemble with the optimizer (-O)
+	int jit;						// whether to run with the jit (-jit)
+	int runs;						// amount of timed runs (-runs)
+	const char* lib;				// library assembled before every workload (-lib)
+} bench_options_t;
+
+// private: get the current time in seconds (only differences between times are meaningful)
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// private: read a whole file into memory (returns NULL if unsuccessful)
+static char* bench_read(const char* filename, size_t* size)
+{
+	FILE* file = fopen(filename, "rb");
+	if(!file)
+	{
+		fprintf(stderr, "ERROR: Could not open %s\n", filename);
+		return NULL;
+	}
+
+	size_t capacity = 0x1000;
+	size_t length = 0;
+	char* data = malloc(capacity);
+	while(data)
+	{
+		length += fread(data + length, 1, capacity - length, file);
+		if(length < capacity) break;
+
+		char* grown = realloc(data, capacity * 2);
+		if(!grown)
+		{
+			free(data);
+			data = NULL;
+			break;
+		}
+		data = grown;
+		capacity *= 2;
+	}
+
+	fclose(file);
+	if(!data)
+		fprintf(stderr, "ERROR: Could not read %s\n", filename);
+	*size = length;
+	return data;
+}
+
+// private: get the name of a workload from its file name
+static void bench_name(const char* filename, char* name)
+{
+	const char* base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+
+	size_t length = strlen(base);
+	if(length > 5 && !strcmp(base + length - 5, ".lasm"))
+		length -= 5;
+	if(length >= BENCH_NAME_LENGTH)
+		length = BENCH_NAME_LENGTH - 1;
+
+	memcpy(name, base, length);
+	name[length] = '\0';
+}
+
+// private: assemble the library and a workload into a program (returns NULL if unsuccessful)
+static word_t* bench_assemble(const bench_options_t* options, const char* lib, size_t lib_size, const char* src,
+	size_t src_size, size_t* length)
+{
+	lasm_t* as = lasm_create();
+	if(!as) return NULL;
+
+	lasm_setopt(as, options->optimize);
+	word_t* program = NULL;
+	if(lasm_assemble(as, lib, lib_size) && lasm_assemble(as, src, src_size) && lasm_finish(as))
+		program = lasm_program(as, length);
+
+	lasm_destroy(as);
+	return program;
+}
+
+// private: measure a workload (runs in the child process, returns false if unsuccessful)
+static int bench_measure(const bench_options_t* options, const char* filename, bench_result_t* result)
+{
+	size_t lib_size = 0, src_size = 0, length = 0;
+	char* lib = bench_read(options->lib, &lib_size);
+	char* src = lib ? bench_read(filename, &src_size) : NULL;
+	lvm_cint_t* builtins = src ? lvm_builtins_create() : NULL;
+	lvm_t* vm = NULL;
+	int ok = 0;
+	if(!builtins) goto done;
+
+	// assembly throughput of the fastest of as many batches as there are runs (the program of the last assembly is the
+	// one which is run)
+	word_t* program = NULL;
+	double start, elapsed;
+	result->asm_rate = 0;
+	int batch; for(batch = 0; batch < options->runs; batch++)
+	{
+		size_t assemblies = 0;
+		start = bench_now();
+		do
+		{
+			free(program);
+			program = bench_assemble(options, lib, lib_size, src, src_size, &length);
+			if(!program)
+			{
+				fprintf(stderr, "ERROR: Could not assemble %s\n", filename);
+				goto done;
+			}
+			++assemblies;
+			elapsed = bench_now() - start;
+		} while(elapsed < BENCH_ASM_SECONDS / options->runs);
+
+		double rate = (lib_size + src_size) * (double)assemblies / elapsed;
+		if(rate > result->asm_rate)
+			result->asm_rate = rate;
+	}
+
+	lvm_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.cint = builtins;
+	config.jit = options->jit;
+	vm = lvm_create(&config);
+	if(!vm)
+	{
+		free(program);
+		goto done;
+	}
+	lvm_load(vm, program, length, 1);
+
+	// the instructions are counted by a profiled run, the timed runs are not profiled
+	lvm_setprof(vm, 1);
+	lvm_run(vm);
+	lvm_setprof(vm, 0);
+	if(!vm->prof)
+	{
+		fprintf(stderr, "ERROR: Could not count the instructions of %s\n", filename);
+		goto done;
+	}
+	result->instrs = 0;
+	int op; for(op = 0; op < 256; op++)
+		result->instrs += vm->prof->ops[op];
+	result->result = vm->result;
+
+	result->seconds = 0;
+	int run; for(run = 0; run < options->runs; run++)
+	{
+		lvm_rewind(vm);
+		start = bench_now();
+		lvm_run(vm);
+		elapsed = bench_now() - start;
+
+		if(vm->result != result->result)
+		{
+			fprintf(stderr, "ERROR: %s halted with %lld and then with %lld\n", filename, result->result, (long long)vm->result);
+			goto done;
+		}
+		if(run == 0 || elapsed < result->seconds)
+			result->seconds = elapsed;
+	}
+	ok = 1;
+
+done:
+	lvm_destroy(vm);
+	lvm_cint_destroy(builtins);
+	free(src);
+	free(lib);
+	return ok;
+}
+
+// private: measure a workload in a child process (returns false if unsuccessful)
+static int bench_run(const bench_options_t* options, const char* filename, bench_result_t* result)
+{
+	memset(result, 0, sizeof(bench_result_t));
+	bench_name(filename, result->name);
+
+	int channel[2];
+	if(pipe(channel) != 0) return 0;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		close(channel[0]);
+		close(channel[1]);
+		return 0;
+	}
+
+	if(pid == 0)
+	{
+		// whatever the workload prints is not part of the report
+		int null = open("/dev/null", O_WRONLY);
+		if(null >= 0)
+		{
+			dup2(null, STDOUT_FILENO);
+			close(null);
+		}
+
+		close(channel[0]);
+		int ok = bench_measure(options, filename, result);
+		fflush(stdout);
+		if(ok && write(channel[1], result, sizeof(bench_result_t)) != (ssize_t)sizeof(bench_result_t))
+			ok = 0;
+		close(channel[1]);
+		_exit(ok ? 0 : 1);
+	}
+
+	close(channel[1]);
+	bench_result_t measured;
+	ssize_t got = read(channel[0], &measured, sizeof(measured));
+	close(channel[0]);
+
+	int status = 0;
+	struct rusage usage;
+	if(wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+		got != (ssize_t)sizeof(measured))
+		return 0;
+
+	*result = measured;
+	result->rss = usage.ru_maxrss;
+	return 1;
+}
+
+// private: read a baseline written by bench_save (returns the amount of results, or -1 if it could not be read)
+static int bench_load(const char* filename, bench_result_t** results)
+{
+	FILE* file = fopen(filename, "r");
+	if(!file)
+	{
+		fprintf(stderr, "ERROR: Could not open %s\n", filename);
+		return -1;
+	}
+
+	int count = 0, capacity = 0;
+	*results = NULL;
+	char line[0x200];
+	while(fgets(line, sizeof(line), file))
+	{
+		if(line[0] == '#' || line[0] == '\n') continue;
+
+		if(count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 0x10;
+			bench_result_t* grown = realloc(*results, capacity * sizeof(bench_result_t));
+			if(!grown) break;
+			*results = grown;
+		}
+
+		bench_result_t* result = &(*results)[count];
+		memset(result, 0, sizeof(bench_result_t));
+		if(sscanf(line, "%63s %llu %lld %lf %ld %lf", result->name, &result->instrs, &result->result, &result->seconds,
+			&result->rss, &result->asm_rate) == 6)
+			++count;
+		else
+			fprintf(stderr, "WARNING: Skipping malformed baseline line: %s", line);
+	}
+
+	fclose(file);
+	return count;
+}
+
+// private: write results as a baseline (returns true if successful)
+static int bench_save(const char* filename, const bench_result_t* results, int count)
+{
+	FILE* file = fopen(filename, "w");
+	if(!file)
+	{
+		fprintf(stderr, "ERROR: Could not open %s\n", filename);
+		return 0;
+	}
+
+	fprintf(file, "# name instructions result seconds peak_rss_kb asm_bytes_per_second\n");
+	int i; for(i = 0; i < count; i++)
+		fprintf(file, "%s %llu %lld %.9f %ld %.1f\n", results[i].name, results[i].instrs, results[i].result,
+			results[i].seconds, results[i].rss, results[i].asm_rate);
+
+	fclose(file);
+	return 1;
+}
+
+// private: compare a result against its baseline, printing what changed (returns the amount of regressions)
+static int bench_compare(const bench_result_t* now, const bench_result_t* base, double tolerance)
+{
+	int regressions = 0;
+
+	// a different result or instruction count means the workload (or the vm) changed, not just its speed
+	if(now->result != base->result || now->instrs != base->instrs)
+	{
+		printf("    CHANGED: result %lld (was %lld), %llu instructions (was %llu)\n", now->result, base->result,
+			now->instrs, base->instrs);
+		++regressions;
+	}
+
+	double rate = now->instrs / now->seconds, base_rate = base->instrs / base->seconds;
+	double speed = (rate / base_rate - 1.0) * 100.0;
+	double asm_speed = (now->asm_rate / base->asm_rate - 1.0) * 100.0;
+	double rss = base->rss ? ((double)now->rss / base->rss - 1.0) * 100.0 : 0.0;
+
+	printf("    vs baseline: %+.1f%% instructions/s, %+.1f%% assembly throughput, %+.1f%% peak rss\n", speed, asm_speed, rss);
+	if(speed < -tolerance)
+	{
+		printf("    REGRESSION: execution is %.1f%% slower\n", -speed);
+		++regressions;
+	}
+	if(asm_speed < -tolerance)
+	{
+		printf("    REGRESSION: assembly is %.1f%% slower\n", -asm_speed);
+		++regressions;
+	}
+	if(rss > tolerance)
+	{
+		printf("    REGRESSION: peak rss grew by %.1f%%\n", rss);
+		++regressions;
+	}
+	return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+	bench_options_t options;
+	options.optimize = 0;
+	options.jit = 0;
+	options.runs = BENCH_RUNS;
+	options.lib = "stdlib.lasm";
+
+	const char* save = NULL;
+	const char* compare = NULL;
+	double tolerance = BENCH_TOLERANCE;
+
+	int i; for(i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if(!strcmp(argv[i], "-O"))
+			options.optimize = 1;
+		else if(!strcmp(argv[i], "-jit"))
+			options.jit = 1;
+		else if(!strcmp(argv[i], "-runs") && i + 1 < argc)
+			options.runs = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-lib") && i + 1 < argc)
+			options.lib = argv[++i];
+		else if(!strcmp(argv[i], "-save") && i + 1 < argc)
+			save = argv[++i];
+		else if(!strcmp(argv[i], "-compare") && i + 1 < argc)
+			compare = argv[++i];
+		else if(!strcmp(argv[i], "-tolerance") && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else
+			break;
+	}
+
+	if(i >= argc || options.runs < 1)
+	{
+		fprintf(stderr, "ERROR: Invalid command line arguments (lbench [-O] [-jit] [-runs n] [-lib stdlib.lasm] [-save baseline] [-compare baseline] [-tolerance percent] workloads...)\n");
+		return 1;
+	}
+
+	bench_result_t* baseline = NULL;
+	int baseline_count = 0;
+	if(compare && (baseline_count = bench_load(compare, &baseline)) < 0)
+		return 1;
+
+	int count = argc - i;
+	bench_result_t* results = calloc(count, sizeof(bench_result_t));
+	if(!results)
+	{
+		free(baseline);
+		return 1;
+	}
+
+	printf("%-12s %14s %8s %10s %10s %10s %10s\n", "workload", "instructions", "result", "best ms", "Minstr/s",
+		"peak KB", "asm MB/s");
+
+	int failures = 0, regressions = 0, measured = 0;
+	for(; i < argc; i++)
+	{
+		bench_result_t* result = &results[measured];
+		if(!bench_run(&options, argv[i], result))
+		{
+			fprintf(stderr, "ERROR: Could not measure %s\n", argv[i]);
+			++failures;
+			continue;
+		}
+		++measured;
+
+		printf("%-12s %14llu %8lld %10.3f %10.1f %10ld %10.2f\n", result->name, result->instrs, result->result,
+			result->seconds * 1e3, result->instrs / result->seconds / 1e6, result->rss, result->asm_rate / 1e6);
+
+		int k; for(k = 0; k < baseline_count; k++)
+		{
+			if(!strcmp(baseline[k].name, result->name))
+			{
+				regressions += bench_compare(result, &baseline[k], tolerance);
+				break;
+			}
+		}
+		if(compare && k == baseline_count)
+			printf("    not in the baseline\n");
+	}
+
+	if(save && !bench_save(save, results, measured))
+		++failures;
+	if(compare)
+		printf("%d regression%s (tolerance %.1f%%)\n", regressions, regressions == 1 ? "" : "s", tolerance);
+
+	free(results);
+	free(baseline);
+	return failures || regressions ? 1 : 0;
+}
@@ -1,8 +1,16 @@
+#include "lasm.h"
+
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* the maximum length of a register name */
 #define MAX_REGCHARS	4
@@ -10,47 +18,36 @@
 /* the maximum length of a mnemomic name */
 #define MAX_MNEMCHARS	6
 
-/* maximum token length */
-#define MAX_TOKLEN		0xFFFF
-
-/* register amount */
-#define NUM_REGS		16
+/* size of the blocks input is read in when it cannot be mapped (i.e. pipes) */
+#define READ_BLOCK_SIZE		0x10000
 
 /* mnemonic amount */
-#define NUM_MNEM		0x27
+#define NUM_MNEM		0x32
 
 /* place this character before register references */
 #define REGISTER_MOD	'%'
 
-/* max length of a variable name */
-#define MAX_VAR_LENGTH	256
+/* size of each block of the name arena */
+#define ARENA_BLOCK_SIZE	0x10000
 
-/* max amount of variables */
-#define MAX_VAR_AMT		0xFFFF
+/* initial capacity of the label and variable tables (a power of two) */
+#define INITIAL_TABLE_CAPACITY	0x100
 
-/* pushi opcode (strings depend on this) */
-#define PUSHI_OPCODE 	0x26
+/* initial capacity of the data section in bytes */
+#define INITIAL_DATA_CAPACITY	0x100
 
-/* the operand types */
-typedef enum 
-{
-	OPTYPE_IRVVV,
-	OPTYPE_IRR00,
-	OPTYPE_IRRR0,
-	OPTYPE_IRRRR,
-	OPTYPE_IVVVV,
-	OPTYPE_IR000,
-} lasm_operand_type;
+/* bytes of zeros kept after the data section, so that reading a whole value (dref) at the last byte of a literal stays
+ * within the program */
+#define DATA_SLACK		sizeof(int64_t)
 
-// variables database
-struct lasm_vars_s
-{
-	char names[MAX_VAR_AMT][MAX_VAR_LENGTH];
-	size_t length;
-} lasm_vars;
+/* pushi opcode (strings depend on this) */
+#define PUSHI_OPCODE 	PUSHI
+
+/* maximum amount of optimization rounds (every round runs every pass once) */
+#define MAX_OPT_ROUNDS	0x10
 
 // mnemonic struct
-struct lasm_mnem_s
+static const struct lasm_mnem_s
 {
 	char name[MAX_MNEMCHARS];
 	uint8_t opcode;
@@ -89,11 +86,22 @@ struct lasm_mnem_s
 	{"asl", 0x23, OPTYPE_IRR00},
 	{"asr", 0x24, OPTYPE_IRR00},
 	{"mask", 0x25, OPTYPE_IRR00},
-	{"pushi", 0x26, OPTYPE_IVVVV}
+	{"pushi", 0x26, OPTYPE_IVVVV},
+	{"jsr", 0x27, OPTYPE_IVVVV},
+	{"str", 0x28, OPTYPE_IRVVV},
+	{"wrt", 0x2A, OPTYPE_IRR00},
+	{"ld8", 0x2B, OPTYPE_IRRV},
+	{"ld16", 0x2C, OPTYPE_IRRV},
+	{"ld32", 0x2D, OPTYPE_IRRV},
+	{"ld64", 0x2E, OPTYPE_IRRV},
+	{"st8", 0x2F, OPTYPE_IRRV},
+	{"st16", 0x30, OPTYPE_IRRV},
+	{"st32", 0x31, OPTYPE_IRRV},
+	{"st64", 0x32, OPTYPE_IRRV}
 };
 
 // register struct
-struct lasm_regs_s
+static const struct lasm_regs_s
 {
 	char name[MAX_REGCHARS];
 	uint8_t value;
@@ -117,537 +125,2311 @@ struct lasm_regs_s
 	{"gr4", 15}		
 };
 
-// token type enum
-typedef enum
-{
-	TOKEN_LABEL,
-	TOKEN_INTEGER,
-	TOKEN_REGISTER,
-	TOKEN_INSTR,
-	TOKEN_STRING,
-} lasm_tokentype;
+// prototypes
+int lasm_symtable_extend(lasm_t* as);
 
-// the token value struct
-struct lasm_token_s 
+// copy a name into the arena (returns NULL if unsuccessful)
+const char* lasm_intern(lasm_t* as, const char* name, size_t length)
 {
-	lasm_tokentype type;		// the type of the token
-	char buffer[MAX_TOKLEN];	// the buffer which has a string representation of the token
-	intptr_t integer;			// if the token was an integer, this holds the integer value of the token
-	size_t pc;					// location in program
-	size_t length;				// length of string in buffer
-} lasm_tokenval;
+	lasm_arena_block_t* block = as->arena;
+
+	if(!block || block->used + length + 1 > block->capacity)
+	{
+		size_t capacity = length + 1 > ARENA_BLOCK_SIZE ? length + 1 : ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(lasm_arena_block_t) + capacity);
+		if(!block) return NULL;
+
+		block->next = as->arena;
+		block->used = 0;
+		block->capacity = capacity;
+		as->arena = block;
+	}
+
+	char* copy = block->data + block->used;
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+	block->used += length + 1;
+	return copy;
+}
 
-// the symbol table struct
-typedef struct
+// free every name in the arena
+void lasm_arena_free(lasm_t* as)
 {
-	size_t capacity;			// the current capacity of the labels array and the pcs array
-	size_t length;				// the current length of the labels array and the pcs array
-	char** labels;				// the labels array
-	size_t* pcs;				// the program counter array
-} lasm_symtable_t;
+	while(as->arena)
+	{
+		lasm_arena_block_t* next = as->arena->next;
+		free(as->arena);
+		as->arena = next;
+	}
+}
 
-// the assembler struct
-struct
+// hash a name (fnv-1a, seeded)
+uint32_t lasm_hash(uint32_t seed, const char* name, size_t length)
 {
-	lasm_symtable_t symbols;							// used for storing and querying labels
-	FILE* input_file;									// input file
-	FILE* output_file;									// output file
-	int last;											// last character read
-	int lineno;											// line number
-	size_t start_pc;									// starting pc
+	uint32_t hash = 2166136261u ^ seed;
+	size_t i; for(i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
 
-} lasm;
+// initialize a name table (returns true if successful)
+int lasm_table_init(lasm_table_t* table)
+{
+	table->capacity = INITIAL_TABLE_CAPACITY;
+	table->length = 0;
+	table->entries = calloc(table->capacity, sizeof(lasm_entry_t));
+	return table->entries != NULL;
+}
 
-// prototypes
-void lasm_symtable_extend();
+// free a name table (the names stay in the arena)
+void lasm_table_free(lasm_table_t* table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->capacity = 0;
+	table->length = 0;
+}
 
-// if a variable exists, this returns its index in the hash, otherwise, it creates it
-size_t lasm_variable_get(const char* name, size_t length)
+// private: find the slot of a name, or the empty slot it would go into
+static lasm_entry_t* lasm_table_slot(lasm_table_t* table, const char* name, size_t length, uint32_t hash)
 {
-	int found = 0;
-	size_t index = 0;
+	size_t mask = table->capacity - 1;
+	size_t i = hash & mask;
 
-	unsigned int i; for(i = 0; i < lasm_vars.length; i++)
+	while(table->entries[i].name)
 	{
-		if(!strcmp(lasm_vars.names[i], name))
-		{	
-			found = 1;
-			index = i;
-		}
+		lasm_entry_t* entry = &table->entries[i];
+		if(entry->hash == hash && entry->length == length && !memcmp(entry->name, name, length))
+			return entry;
+		i = (i + 1) & mask;
 	}
 
-	if(!found)
+	return &table->entries[i];
+}
+
+// private: double the capacity of a name table (returns true if successful)
+static int lasm_table_grow(lasm_table_t* table)
+{
+	lasm_table_t grown;
+	grown.capacity = table->capacity * 2;
+	grown.length = table->length;
+	grown.entries = calloc(grown.capacity, sizeof(lasm_entry_t));
+	if(!grown.entries) return 0;
+
+	size_t i; for(i = 0; i < table->capacity; i++)
 	{
-		index = lasm_vars.length;
-		memcpy(lasm_vars.names[i], name, length * sizeof(char)); 
-		++lasm_vars.length;
+		const lasm_entry_t* entry = &table->entries[i];
+		if(entry->name)
+			*lasm_table_slot(&grown, entry->name, entry->length, entry->hash) = *entry;
 	}
 
-	return index;
+	free(table->entries);
+	*table = grown;
+	return 1;
 }
 
-// initialize the assemblers symtable
-void lasm_init_symtable()
+// look up a name in a table (returns NULL if it is not in the table)
+lasm_entry_t* lasm_table_get(lasm_table_t* table, const char* name, size_t length)
 {
-	lasm.symbols.length = 0;
-	lasm.symbols.capacity = 2;
-	lasm.symbols.labels = malloc(sizeof(char*) * lasm.symbols.capacity);
-	lasm.symbols.pcs = malloc(sizeof(size_t) * lasm.symbols.capacity);
+	lasm_entry_t* entry = lasm_table_slot(table, name, length, lasm_hash(0, name, length));
+	return entry->name ? entry : NULL;
 }
 
-// initialize the assembler
-int lasm_init(const char* inp, const char* out, int append, size_t start)
+// look up a name in a table, adding it with the given value if it is not there yet (returns NULL if unsuccessful)
+lasm_entry_t* lasm_table_put(lasm_t* as, lasm_table_t* table, const char* name, size_t length, size_t value)
 {
-	lasm.start_pc = start;
-	lasm.input_file = fopen(inp, "r");
-	if(!lasm.input_file) return 0;
-	lasm.output_file = fopen(out, append ? "a+" : "w+");
-	if(!lasm.output_file) return 0;
-	lasm.last = ' ';
-	lasm_tokenval.buffer[0] = '\0';
-	lasm_tokenval.pc = start;
-	lasm_tokenval.integer = 0;
-	lasm.lineno = 1;
+	// keep the table at most half full
+	if((table->length + 1) * 2 > table->capacity && !lasm_table_grow(table)) return NULL;
+
+	uint32_t hash = lasm_hash(0, name, length);
+	lasm_entry_t* entry = lasm_table_slot(table, name, length, hash);
+	if(entry->name) return entry;
+
+	entry->name = lasm_intern(as, name, length);
+	if(!entry->name) return NULL;
+	entry->length = length;
+	entry->hash = hash;
+	entry->value = value;
+	++table->length;
+	return entry;
 }
 
-// close the assembler files
-void lasm_close_files()
+// private: find a seed for which every name hashes to its own slot and fill in the slots (returns the seed),
+// unused entries (empty names) are skipped
+static uint32_t lasm_perfect_hash(int8_t* slots, size_t slot_count, const char* names, size_t stride, size_t max, size_t count)
 {
-	if(lasm.input_file) 
+	uint32_t seed; for(seed = 0; ; seed++)
 	{
-		fclose(lasm.input_file);
-		lasm.input_file = NULL;
+		memset(slots, -1, slot_count);
+
+		size_t i; for(i = 0; i < count; i++)
+		{
+			const char* name = names + i * stride;
+			size_t length = 0;
+			while(length < max && name[length])
+				++length;
+			if(!length) continue;
+
+			uint32_t slot = lasm_hash(seed, name, length) & (slot_count - 1);
+			if(slots[slot] >= 0) break;
+			slots[slot] = i;
+		}
+
+		if(i == count) return seed;
 	}
+}
 
-	if(lasm.output_file)
+// if a variable exists, this returns its index in the hash, otherwise, it creates it
+size_t lasm_variable_get(lasm_t* as, const char* name, size_t length)
+{
+	lasm_entry_t* entry = lasm_table_put(as, &as->variables, name, length, as->variables.length);
+	if(!entry)
 	{
-		fclose(lasm.output_file);
-		lasm.output_file = NULL;
+		fprintf(stderr, "ERROR: Out of memory while adding variable (%.*s)\n", (int)length, name);
+		++as->errors;
+		return 0;
 	}
+	return entry->value;
 }
 
-// close the assembler
-void lasm_close()
+// initialize the assemblers symtable
+void lasm_init_symtable(lasm_t* as)
+{
+	as->symbols.length = 0;
+	as->symbols.capacity = 2;
+	as->symbols.labels = malloc(sizeof(char*) * as->symbols.capacity);
+	as->symbols.pcs = malloc(sizeof(size_t) * as->symbols.capacity);
+	if(!as->symbols.labels || !as->symbols.pcs)
+		as->symbols.capacity = 0;
+
+	lasm_table_init(&as->labels);
+	lasm_table_init(&as->variables);
+	lasm_table_init(&as->literals);
+	as->arena = NULL;
+
+	// the mnemonics and registers never change, so they get collision free tables
+	as->mnem_seed = lasm_perfect_hash(as->mnem_slots, MNEM_SLOTS, lasm_mnemdefs[0].name, sizeof(lasm_mnemdefs[0]),
+		MAX_MNEMCHARS, NUM_MNEM);
+	as->reg_seed = lasm_perfect_hash(as->reg_slots, REG_SLOTS, lasm_regdefs[0].name, sizeof(lasm_regdefs[0]),
+		MAX_REGCHARS, NUM_REGS);
+}
+
+// private: get the contents of the input file into memory, mapping regular files and reading anything else in blocks
+// (returns true if successful)
+static int lasm_load_source(lasm_t* as)
 {
-	unsigned int i; for(i = 0; i < lasm.symbols.length; i++)
-		free(lasm.symbols.labels[i]);
+	as->source = NULL;
+	as->source_size = 0;
+	as->mapped = 0;
+
+#ifndef _WIN32
+	struct stat st;
+	int fd = fileno(as->input_file);
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(base != MAP_FAILED)
+		{
+			as->source = base;
+			as->source_size = st.st_size;
+			as->mapped = 1;
+			return 1;
+		}
+	}
+#endif
+
+	size_t capacity = 0;
+	for(;;)
+	{
+		if(capacity - as->source_size < READ_BLOCK_SIZE)
+		{
+			capacity = capacity ? capacity * 2 : READ_BLOCK_SIZE;
+			char* grown = realloc(as->source, capacity);
+			if(!grown) return 0;
+			as->source = grown;
+		}
 
-	free(lasm.symbols.pcs);
-	free(lasm.symbols.labels);
+		size_t read = fread(as->source + as->source_size, 1, capacity - as->source_size, as->input_file);
+		as->source_size += read;
+		if(read == 0) break;
+	}
 
-	lasm.symbols.labels = NULL;
-	lasm.symbols.pcs = NULL;
+	return !ferror(as->input_file);
 }
 
-// gets register index given register name
-int lasm_get_reg(const char* name)
+// open an input file for the assembler ("-" reads from stdin) and get its contents into memory
+int lasm_open(lasm_t* as, const char* inp)
 {
-	unsigned int i; for(i = 0; i < NUM_REGS; i++)
+	as->input_file = strcmp(inp, "-") ? fopen(inp, "rb") : stdin;
+	if(!as->input_file) return 0;
+	if(!lasm_load_source(as))
 	{
-		if(!strcmp(name, lasm_regdefs[i].name))
-			return i;
+		free(as->source);
+		as->source = NULL;
+		if(as->input_file != stdin)
+			fclose(as->input_file);
+		as->input_file = NULL;
+		return 0;
 	}
+	return 1;
+}
 
-	fprintf(stderr, "ERROR: Attempted to access non-existent register (%s)\n", name);
-	return -1;
+// close the assembler files
+void lasm_close_files(lasm_t* as)
+{
+#ifndef _WIN32
+	if(as->mapped)
+		munmap(as->source, as->source_size);
+	else
+		free(as->source);
+#else
+	free(as->source);
+#endif
+	as->source = NULL;
+	as->source_size = 0;
+	as->mapped = 0;
+	as->cur = as->end = NULL;
+
+	if(as->input_file) 
+	{
+		if(as->input_file != stdin)
+			fclose(as->input_file);
+		as->input_file = NULL;
+	}
 }
 
-// gets mnemonic index given mnem name
-int lasm_get_mnem(const char* name)
+// output an encoded instruction word
+void lasm_emit(lasm_t* as, word_t word)
 {
-	unsigned int i; for(i = 0; i < NUM_MNEM; i++)
+	if(as->code_length >= as->code_capacity)
+	{
+		size_t capacity = as->code_capacity ? as->code_capacity * 2 : 0x400;
+		word_t* code = realloc(as->code, capacity * sizeof(word_t));
+		if(!code)
+		{
+			fprintf(stderr, "ERROR: Out of memory while adding instruction\n");
+			++as->errors;
+			return;
+		}
+		as->code = code;
+		as->code_capacity = capacity;
+	}
+	as->code[as->code_length++] = word;
+}
+
+// append bytes to the data section (returns the offset they were stored at, or -1 if unsuccessful)
+static long lasm_data_append(lasm_t* as, const void* bytes, size_t length)
+{
+	// offsets have to fit the immediate of str and the length of the section the long immediate of its DATA word
+	if(as->data_length > IMMVL_MASK || length > LIMMVL_MASK - DATA_SLACK - as->data_length)
+	{
+		fprintf(stderr, "ERROR: At line %i\nData section is full\n", as->lineno);
+		++as->errors;
+		return -1;
+	}
+
+	if(as->data_length + length > as->data_capacity)
 	{
-		if(!strcmp(name, lasm_mnemdefs[i].name))
-			return i;
+		size_t capacity = as->data_capacity ? as->data_capacity : INITIAL_DATA_CAPACITY;
+		while(capacity < as->data_length + length)
+			capacity *= 2;
+
+		uint8_t* data = realloc(as->data, capacity);
+		if(!data)
+		{
+			fprintf(stderr, "ERROR: Out of memory while adding data\n");
+			++as->errors;
+			return -1;
+		}
+		as->data = data;
+		as->data_capacity = capacity;
 	}
 
-	fprintf(stderr, "ERROR: Attempted to use non-existent mnemonic (%s)\n", name);
+	long offset = as->data_length;
+	memcpy(as->data + as->data_length, bytes, length);
+	as->data_length += length;
+	return offset;
 }
 
-// gets instruction location given label name
-size_t lasm_get_pc_from_label(const char* label)
+// add a null terminated string literal to the data section, literals with the same text are stored once (returns the
+// offset of the literal)
+size_t lasm_data_literal(lasm_t* as, const char* str, size_t len)
 {
-	unsigned int i; for(i = 0; i < lasm.symbols.length; i++)
+	lasm_entry_t* entry = lasm_table_get(&as->literals, str, len);
+	if(entry) return entry->value;
+
+	long offset = lasm_data_append(as, str, len);
+	if(offset < 0 || lasm_data_append(as, "", 1) < 0) return 0;
+
+	if(!lasm_table_put(as, &as->literals, str, len, offset))
 	{
-		if(!strcmp(label, lasm.symbols.labels[i]))
-			return lasm.symbols.pcs[i];
+		fprintf(stderr, "ERROR: Out of memory while adding string literal\n");
+		++as->errors;
 	}
-	return 0;
+	return offset;
 }
 
-// puts a label in the symbol table
-void lasm_symtable_put_label(const char* label, size_t pc)
+// get the amount of words the data section takes in a program (including the zeros after it)
+size_t lasm_data_words(lasm_t* as)
 {
-	lasm.symbols.labels[lasm.symbols.length] = strdup(label);
-	lasm.symbols.pcs[lasm.symbols.length] = pc;
-	++lasm.symbols.length;
-	lasm_symtable_extend();
+	if(!as->data_length) return 0;
+	return (as->data_length + DATA_SLACK + sizeof(word_t) - 1) / sizeof(word_t);
 }
 
-// private: extends the assemblers symbol table length
-void lasm_symtable_extend()
+// get the operand layout of an opcode
+lasm_operand_type lasm_get_optype(uint8_t opcode)
 {
-	while(lasm.symbols.length >= lasm.symbols.capacity)
+	unsigned int i; for(i = 0; i < NUM_MNEM; i++)
 	{
-		lasm.symbols.capacity *= 2;
-		lasm.symbols.labels = realloc(lasm.symbols.labels, lasm.symbols.capacity * sizeof(char*));
-		lasm.symbols.pcs = realloc(lasm.symbols.pcs, lasm.symbols.capacity * sizeof(size_t));
+		if(lasm_mnemdefs[i].opcode == opcode)
+			return lasm_mnemdefs[i].optype;
 	}
+	return OPTYPE_IVVVV;
 }
 
-// prints the symbol table
-void lasm_symtable_debug()
+// initialize an intermediate instruction for an opcode with all of its operands zeroed
+void lasm_ir_init(lasm_ir_t* ir, uint8_t opcode)
 {
-	unsigned int i; for(i = 0; i < lasm.symbols.length; i++)
-		printf("label %s at pc %u\n", lasm.symbols.labels[i], lasm.symbols.pcs[i]);
+	ir->opcode = opcode;
+	ir->optype = lasm_get_optype(opcode);
+	memset(ir->regs, 0, sizeof(ir->regs));
+	ir->integer = 0;
+	ir->label = 0;
+	ir->dead = 0;
 }
 
-// handle escape sequences 
-void lasm_handle_escape_seq()
+// get the amount of words an intermediate instruction takes when its immediate holds value (mov and the branches take
+// a wide form if it does not fit their word), returns 0 if the value does not fit the instruction at all
+size_t lasm_ir_words(const lasm_ir_t* ir, intptr_t value)
 {
-	if(lasm.last == '\\')
+	switch(ir->opcode)
 	{
-		lasm.last = fgetc(lasm.input_file);
-		switch(lasm.last)
-		{
-			case 'n':
-				lasm.last = '\n';
-			break;
-			case 'r':
-				lasm.last = '\r';
-			break;
-			case 't':
-				lasm.last = '\t';
-			break;
-			case '0':
-				lasm.last = '\0';
-			break;
-			case '\'':
-				lasm.last = '\'';
-			break;
-			case '"':
-				lasm.last = '\"';
-			break;
-			case '\\':
-				lasm.last = '\\';
-			break;
-		}
+	case MOV:
+		if(value >= 0 && value <= IMMVL_MASK) return 1;
+		return value >= INT32_MIN && value <= INT32_MAX ? 2 : 3;
+	case JNZ: case JZ:
+		if(value >= 0 && value <= IMMVL_MASK) return 1;
+		return value >= 0 && (uintmax_t)value <= UINT32_MAX ? 2 : 0;
+	case JMP: case JNE: case JE: case JGT: case JLT: case JGE: case JLE: case JSR:
+		if(value >= 0 && value <= LIMMVL_MASK) return 1;
+		return value >= 0 && (uintmax_t)value <= UINT32_MAX ? 2 : 0;
+	}
+
+	switch(ir->optype)
+	{
+	case OPTYPE_IRVVV: return value >= 0 && value <= IMMVL_MASK;
+	case OPTYPE_IVVVV: return value >= 0 && value <= LIMMVL_MASK;
+	case OPTYPE_IRRV: return value >= INT16_MIN && value <= INT16_MAX;
+	default: return 1;
 	}
 }
 
-// assemble a string into a sequence of stack instructions
-void lasm_lex_string()
+// encode an intermediate instruction into length words (1, or the amount its wide form takes, see lasm_ir_words)
+void lasm_encode(const lasm_ir_t* ir, size_t length, word_t* words)
 {
-	lasm.last = fgetc(lasm.input_file);
+	if(length > 1)
+	{
+		// a mov becomes movw or movq, a branch becomes a long branch holding its opcode
+		uint64_t value = (uint64_t)ir->integer;
+		if(ir->opcode == MOV)
+			words[0] = ENCODE_IR00(length == 2 ? MOVW : MOVQ, ir->regs[0]);
+		else
+			words[0] = ENCODE_IRVV(LONG, ir->regs[0], ir->opcode);
+		words[1] = (word_t)value;
+		if(length > 2)
+			words[2] = (word_t)(value >> 32);
+		return;
+	}
 
-	int pos = 0;
-	while(lasm.last != '"')
+	switch(ir->optype)
 	{
-		lasm_handle_escape_seq();
-		// each character amounts to one instruction
-		++lasm_tokenval.pc;	
-		lasm_tokenval.buffer[pos] = lasm.last;
-		lasm.last = fgetc(lasm.input_file);
-		++pos;
-		lasm_tokenval.buffer[pos] = '\0';
+	case OPTYPE_IRVVV: words[0] = ENCODE_IRVV(ir->opcode, ir->regs[0], ir->integer & IMMVL_MASK); break;
+	case OPTYPE_IR000: words[0] = ENCODE_IR00(ir->opcode, ir->regs[0]); break;
+	case OPTYPE_IVVVV: words[0] = ENCODE_IVVV(ir->opcode, ir->integer & LIMMVL_MASK); break;
+	case OPTYPE_IRR00: words[0] = ENCODE_IRR0(ir->opcode, ir->regs[0], ir->regs[1]); break;
+	case OPTYPE_IRRR0: words[0] = ENCODE_IRRR0(ir->opcode, ir->regs[0], ir->regs[1], ir->regs[2]); break;
+	case OPTYPE_IRRRR: words[0] = ENCODE_IRRRR(ir->opcode, ir->regs[0], ir->regs[1], ir->regs[2], ir->regs[3]); break;
+	case OPTYPE_IRRV: words[0] = ENCODE_IRRV(ir->opcode, ir->regs[0], ir->regs[1], ir->integer); break;
 	}
-	lasm_tokenval.length = pos;
-}	
+}
 
-// outputs a string as a series of instructions
-void lasm_output_string(const char* str, size_t len)
+// decode an instruction (INSTR_WORDS of words) into an intermediate instruction, wide forms are decoded as the mov or
+// branch they hold
+void lasm_decode(const word_t* words, lasm_ir_t* ir)
 {
-	fprintf(lasm.output_file, "%02x%06x\n", PUSHI_OPCODE, '\0');
-
-	int pos = len;
+	word_t word = words[0];
+	uint8_t opcode = word >> 24;
 
-	while(pos >= 0)
+	if(opcode == MOVW || opcode == MOVQ || opcode == LONG)
 	{
-		int ch = str[pos];
-		fprintf(lasm.output_file, "%02x%06x\n", PUSHI_OPCODE, ch);
-		pos -= 1;
+		lasm_ir_init(ir, opcode == LONG ? word & BRANCH_MASK : MOV);
+		ir->regs[0] = (word & REG1_MASK) >> 20;
+		if(opcode == MOVW)
+			ir->integer = (int32_t)words[1];
+		else if(opcode == MOVQ)
+			ir->integer = (intptr_t)(words[1] | (uint64_t)words[2] << 32);
+		else
+			ir->integer = (intptr_t)words[1];
+		return;
 	}
+
+	lasm_ir_init(ir, opcode);
+
+	if(ir->optype != OPTYPE_IVVVV)
+		ir->regs[0] = (word & REG1_MASK) >> 20;
+	if(ir->optype == OPTYPE_IRR00 || ir->optype == OPTYPE_IRRR0 || ir->optype == OPTYPE_IRRRR || ir->optype == OPTYPE_IRRV)
+		ir->regs[1] = (word & REG2_MASK) >> 16;
+	if(ir->optype == OPTYPE_IRRR0 || ir->optype == OPTYPE_IRRRR)
+		ir->regs[2] = (word & REG3_MASK) >> 12;
+	if(ir->optype == OPTYPE_IRRRR)
+		ir->regs[3] = (word & REG4_MASK) >> 8;
+
+	if(ir->optype == OPTYPE_IRVVV)
+		ir->integer = word & IMMVL_MASK;
+	else if(ir->optype == OPTYPE_IVVVV)
+		ir->integer = word & LIMMVL_MASK;
+	else if(ir->optype == OPTYPE_IRRV)
+		ir->integer = (int16_t)(word & OFFSET_MASK);
 }
 
-// read a token from the assemblers input file
-int lasm_read_token()
+// output an intermediate instruction (kept until the program is finished, encoded straight away in an object, where
+// references keep the short form so that they can be patched once the object is linked)
+void lasm_emit_ir(lasm_t* as, const lasm_ir_t* ir)
 {
-	if(lasm.input_file)
+	if(!as->buffered)
 	{
-		if(feof(lasm.input_file)) return 0;
+		word_t words[3];
+		size_t length = ir->label ? 1 : lasm_ir_words(ir, ir->integer);
+		if(!length) length = 1;
+
+		lasm_encode(ir, length, words);
+		size_t i; for(i = 0; i < length; i++)
+			lasm_emit(as, words[i]);
+		return;
+	}
 
-		while(isspace(lasm.last))
+	if(as->ir_length >= as->ir_capacity)
+	{
+		size_t capacity = as->ir_capacity ? as->ir_capacity * 2 : 0x400;
+		lasm_ir_t* buffer = realloc(as->ir, capacity * sizeof(lasm_ir_t));
+		if(!buffer)
 		{
-			if(lasm.last == '\n' || lasm.last == '\r') ++lasm.lineno;
-			lasm.last = fgetc(lasm.input_file);
+			fprintf(stderr, "ERROR: At line %i\nOut of memory while adding instruction\n", as->lineno);
+			++as->errors;
+			return;
 		}
+		as->ir = buffer;
+		as->ir_capacity = capacity;
+	}
+	as->ir[as->ir_length++] = *ir;
+}
 
-		if(feof(lasm.input_file)) return 0;
-
-		if(isalpha(lasm.last))
-		{
-			int pos = 0; 
-			while(isalnum(lasm.last) || lasm.last == '_')
-			{
-				lasm_tokenval.buffer[pos] = lasm.last;
-				++pos;
-				lasm_tokenval.buffer[pos] = '\0';
-				lasm.last = fgetc(lasm.input_file);
-			}
+// get the location the next instruction is assembled at
+size_t lasm_pc(lasm_t* as)
+{
+	return as->buffered ? as->ir_length : as->code_length;
+}
 
-			if(lasm.last == ':')
-			{
-				lasm_tokenval.type = TOKEN_LABEL;
-				lasm.last = fgetc(lasm.input_file);
-			}
-			else
-			{
-				++lasm_tokenval.pc; 
-				lasm_tokenval.type = TOKEN_INSTR;
-			}
-		}
-		else if(lasm.last == '%')
-		{
-			lasm.last = fgetc(lasm.input_file);
-			int pos = 0;
-			while(isalnum(lasm.last))
-			{
-				lasm_tokenval.buffer[pos] = lasm.last;
-				++pos;
-				lasm_tokenval.buffer[pos] = '\0';
-				lasm.last = fgetc(lasm.input_file);
-			}
-			lasm_tokenval.type = TOKEN_REGISTER;
-		}
-		else if(lasm.last == '"')
+// record that the instruction about to be assembled refers to a label which is not defined yet
+void lasm_add_fixup(lasm_t* as, int kind, size_t at, const char* name, size_t length, int lineno)
+{
+	if(as->fixup_length >= as->fixup_capacity)
+	{
+		size_t capacity = as->fixup_capacity ? as->fixup_capacity * 2 : 0x100;
+		lasm_fixup_t* fixups = realloc(as->fixups, capacity * sizeof(lasm_fixup_t));
+		if(!fixups)
 		{
-			lasm_lex_string();
-			lasm.last = fgetc(lasm.input_file);
-			lasm_tokenval.type = TOKEN_STRING;
+			fprintf(stderr, "ERROR: At line %i\nOut of memory while adding reference (%.*s)\n", lineno, (int)length,
+				name);
+			++as->errors;
+			return;
 		}
-		else if(isdigit(lasm.last))
-		{
-			int pos = 0;
+		as->fixups = fixups;
+		as->fixup_capacity = capacity;
+	}
 
-			while(isdigit(lasm.last))
-			{
-				lasm_tokenval.buffer[pos] = lasm.last;
-				++pos;
-				lasm_tokenval.buffer[pos] = '\0';
-				lasm.last = fgetc(lasm.input_file);
-			}
-			lasm_tokenval.type = TOKEN_INTEGER;
-			lasm_tokenval.integer = strtol(lasm_tokenval.buffer, NULL, 10);
-		}
-		else if(lasm.last == '@')
-		{
-			lasm.last = fgetc(lasm.input_file);
-			int pos = 0;
-			while(isalnum(lasm.last) || lasm.last == '_')
-			{
-				lasm_tokenval.buffer[pos] = lasm.last;
-				++pos;
-				lasm_tokenval.buffer[pos] = '\0';
-				lasm.last = fgetc(lasm.input_file);
-			}
-			lasm_tokenval.type = TOKEN_INTEGER;
-			lasm_tokenval.integer = lasm_get_pc_from_label(lasm_tokenval.buffer);
-		}
-		else if(lasm.last == '#')
-		{
-			lasm.last = fgetc(lasm.input_file);
-			int pos = 0;
-			while(isalnum(lasm.last) || lasm.last == '_')
-			{
-				lasm_tokenval.buffer[pos] = lasm.last;
-				++pos;
-				lasm_tokenval.buffer[pos] = '\0';
-				lasm.last = fgetc(lasm.input_file);
-			}
-			lasm_tokenval.type = TOKEN_INTEGER;
-			lasm_tokenval.integer = lasm_variable_get(lasm_tokenval.buffer, pos);
-		}
-		else if(lasm.last == '\'')
-		{
-			lasm.last = fgetc(lasm.input_file);
-			lasm_handle_escape_seq();
-			lasm_tokenval.type = TOKEN_INTEGER;
-			lasm_tokenval.integer = lasm.last;
-			lasm.last= fgetc(lasm.input_file);
-		}
-		else if(lasm.last == ';')
-		{
-			lasm.last = fgetc(lasm.input_file);
-			while(lasm.last != ';' && lasm.last != EOF)
-				lasm.last = fgetc(lasm.input_file);
-			lasm.last = fgetc(lasm.input_file);
+	lasm_fixup_t* fixup = &as->fixups[as->fixup_length++];
+	fixup->kind = kind;
+	fixup->at = at;
+	fixup->name = lasm_intern(as, name, length);
+	fixup->lineno = lineno;
+}
 
-			if(lasm.last == EOF) return 0;
-		}
-		else if(lasm.last == EOF) 
-			return 0;
+// record the name the integer token just read refers to if the instruction about to be assembled has to be patched
+// later on (every label and variable reference when assembling an object, forward label references otherwise)
+void lasm_add_reference(lasm_t* as)
+{
+	if(as->relocatable && (as->token.label || as->token.variable))
+	{
+		int kind = as->token.label ? LOBJ_RELOC_LABEL : LOBJ_RELOC_VAR;
+		lasm_add_fixup(as, kind, lasm_pc(as), as->token.text, as->token.length, as->lineno);
+	}
+	else if(as->token.label && !as->token.resolved)
+		lasm_add_fixup(as, LOBJ_RELOC_LABEL, lasm_pc(as), as->token.text, as->token.length, as->lineno);
+}
 
-		return 1;
+// private: replace the immediate of the instruction at a location (which holds a label location if label is set)
+static void lasm_patch(lasm_t* as, size_t at, size_t value, int label)
+{
+	if(as->buffered)
+	{
+		as->ir[at].integer = value;
+		as->ir[at].label |= label;
+		return;
 	}
 
-	return 0;
+	word_t word = as->code[at];
+	lasm_operand_type optype = lasm_get_optype(word >> 24);
+	word_t mask = optype == OPTYPE_IVVVV ? LIMMVL_MASK : optype == OPTYPE_IRRV ? OFFSET_MASK : IMMVL_MASK;
+	as->code[at] = (word & ~mask) | (value & mask);
+}
+
+// patch every reference to a label that was defined after it was used (undefined labels resolve to 0)
+void lasm_resolve_fixups(lasm_t* as)
+{
+	size_t i; for(i = 0; i < as->fixup_length; i++)
+	{
+		const lasm_fixup_t* fixup = &as->fixups[i];
+		lasm_entry_t* entry = fixup->name ? lasm_table_get(&as->labels, fixup->name, strlen(fixup->name)) : NULL;
+		uint8_t opcode = as->buffered ? as->ir[fixup->at].opcode : as->code[fixup->at] >> 24;
+
+		// the label of a ret only documents the routine, so it does not have to exist
+		if(!entry && opcode != RET)
+			fprintf(stderr, "WARNING: Reference to undefined label (%s) at line %i\n", fixup->name, fixup->lineno);
+		lasm_patch(as, fixup->at, entry ? entry->value : 0, 1);
+	}
+
+	as->fixup_length = 0;
 }
 
-// build the symbol table (optionally move the relocation program counter if reloc_pc is not null)
-void lasm_symtable_build(size_t* reloc_pc)
+// private: write the data section followed by the zeros after it (words of them in total)
+static void lasm_write_data(lasm_t* as, FILE* file, size_t words)
 {
-	if(!lasm.input_file) return;
+	static const uint8_t zeros[sizeof(word_t) + DATA_SLACK] = {0};
+
+	fwrite(as->data, 1, as->data_length, file);
+	if(words)
+		fwrite(zeros, 1, words * sizeof(word_t) - as->data_length, file);
+}
 
-	int parse = lasm_read_token();
+// write the program into a text file (one hex word per line, the data section follows the code as in lasm_program),
+// returns true if successful
+int lasm_write_text(lasm_t* as, const char* out)
+{
+	size_t length;
+	word_t* program = lasm_program(as, &length);
+	if(!program) return 0;
 
-	while(parse)
+	FILE* file = fopen(out, "w");
+	if(!file)
 	{
-		if(lasm_tokenval.type == TOKEN_LABEL)
-			lasm_symtable_put_label(lasm_tokenval.buffer, lasm_tokenval.pc);
-		else if(lasm_tokenval.type == TOKEN_INSTR)
-		{
-			if(reloc_pc) *reloc_pc = (*reloc_pc + 1);
-		}
-		parse = lasm_read_token();
+		free(program);
+		return 0;
 	}
 
-	rewind(lasm.input_file);
-	lasm_tokenval.buffer[0] = '\0';
-	lasm_tokenval.pc = lasm.start_pc;
-	lasm_tokenval.integer = 0;
-	lasm.last = ' ';
-	lasm.lineno = 1;
+	size_t i; for(i = 0; i < length; i++)
+		fprintf(file, "%08x\n", program[i]);
+
+	int ok = !ferror(file);
+	fclose(file);
+	free(program);
+	return ok;
 }
 
-void lasm_expect_token_type(lasm_tokentype type)
+// write the assembled words, the data section and the symbol table into a binary container (returns true if successful)
+int lasm_write_binary(lasm_t* as, const char* out)
 {
-	if(lasm_tokenval.type != type)
-		fprintf(stderr, "ERROR: At line %i\nExpected token type %i, but received %i\n", lasm.lineno, type, lasm_tokenval.type);
+	FILE* file = fopen(out, "wb");
+	if(!file) return 0;
+
+	size_t data_words = lasm_data_words(as);
+
+	uint32_t str_length = 0;
+	unsigned int i; for(i = 0; i < as->symbols.length; i++)
+		str_length += strlen(as->symbols.labels[i]) + 1;
+
+	lvm_bin_header_t header;
+	header.magic = LVMB_MAGIC;
+	header.version = LVMB_VERSION;
+	header.code_offset = sizeof(lvm_bin_header_t);
+	header.code_length = as->code_length;
+	header.data_offset = header.code_offset + header.code_length * sizeof(word_t);
+	header.data_length = as->data_length;
+	header.sym_offset = header.data_offset + data_words * sizeof(word_t);
+	header.sym_count = as->symbols.length;
+	header.str_offset = header.sym_offset + header.sym_count * sizeof(lvm_bin_sym_t);
+	header.str_length = str_length;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(as->code, sizeof(word_t), as->code_length, file);
+	lasm_write_data(as, file, data_words);
+
+	uint32_t name = 0;
+	for(i = 0; i < as->symbols.length; i++)
+	{
+		lvm_bin_sym_t sym;
+		sym.pc = as->symbols.pcs[i];
+		sym.name = name;
+		fwrite(&sym, sizeof(sym), 1, file);
+		name += strlen(as->symbols.labels[i]) + 1;
+	}
+
+	for(i = 0; i < as->symbols.length; i++)
+		fwrite(as->symbols.labels[i], 1, strlen(as->symbols.labels[i]) + 1, file);
 
-	assert(lasm_tokenval.type == type);
+	// pad the file so that the container size stays 4 byte aligned
+	static const char padding[sizeof(uint32_t)] = {0};
+	if(str_length % sizeof(uint32_t))
+		fwrite(padding, 1, sizeof(uint32_t) - str_length % sizeof(uint32_t), file);
+
+	int ok = !ferror(file);
+	fclose(file);
+	return ok;
 }
 
-// parse a token from the assemblers and spit an opcode into the file
-int lasm_parse_token(size_t* instr)
+// write the assembled words, the label definitions and the relocations into an object container (returns true if
+// successful)
+int lasm_write_object(lasm_t* as, const char* out)
 {
-	if(!lasm.output_file) return 0;
+	if(!lasm_finish(as)) return 0;
+
+	FILE* file = fopen(out, "wb");
+	if(!file) return 0;
+
+	size_t data_words = lasm_data_words(as);
+
+	uint32_t str_length = 0;
+	unsigned int i; for(i = 0; i < as->symbols.length; i++)
+		str_length += strlen(as->symbols.labels[i]) + 1;
+	for(i = 0; i < as->fixup_length; i++)
+		str_length += strlen(as->fixups[i].name) + 1;
+
+	lasm_obj_header_t header;
+	header.magic = LOBJ_MAGIC;
+	header.version = LOBJ_VERSION;
+	header.code_offset = sizeof(lasm_obj_header_t);
+	header.code_length = as->code_length;
+	header.data_offset = header.code_offset + header.code_length * sizeof(word_t);
+	header.data_length = as->data_length;
+	header.sym_offset = header.data_offset + data_words * sizeof(word_t);
+	header.sym_count = as->symbols.length;
+	header.reloc_offset = header.sym_offset + header.sym_count * sizeof(lvm_bin_sym_t);
+	header.reloc_count = as->fixup_length;
+	header.str_offset = header.reloc_offset + header.reloc_count * sizeof(lasm_obj_reloc_t);
+	header.str_length = str_length;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(as->code, sizeof(word_t), as->code_length, file);
+	lasm_write_data(as, file, data_words);
+
+	uint32_t name = 0;
+	for(i = 0; i < as->symbols.length; i++)
+	{
+		lvm_bin_sym_t sym;
+		sym.pc = as->symbols.pcs[i];
+		sym.name = name;
+		fwrite(&sym, sizeof(sym), 1, file);
+		name += strlen(as->symbols.labels[i]) + 1;
+	}
 
-	int parse = lasm_read_token();
+	for(i = 0; i < as->fixup_length; i++)
+	{
+		lasm_obj_reloc_t reloc;
+		reloc.at = as->fixups[i].at;
+		reloc.kind = as->fixups[i].kind;
+		reloc.name = name;
+		reloc.lineno = as->fixups[i].lineno;
+		fwrite(&reloc, sizeof(reloc), 1, file);
+		name += strlen(as->fixups[i].name) + 1;
+	}
 
-	if(!parse) return 0;
+	for(i = 0; i < as->symbols.length; i++)
+		fwrite(as->symbols.labels[i], 1, strlen(as->symbols.labels[i]) + 1, file);
+	for(i = 0; i < as->fixup_length; i++)
+		fwrite(as->fixups[i].name, 1, strlen(as->fixups[i].name) + 1, file);
 
-	if(lasm_tokenval.type == TOKEN_INSTR)
-	{
-		*instr = (*instr) + 1;
-		int mnem_idx = lasm_get_mnem(lasm_tokenval.buffer);
-		
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRVVV)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_INTEGER);
-			fprintf(lasm.output_file, "%02x%01x%05x\n", lasm_mnemdefs[mnem_idx].opcode, reg, lasm_tokenval.integer);
-		}
+	// pad the file so that the container size stays 4 byte aligned
+	static const char padding[sizeof(uint32_t)] = {0};
+	if(str_length % sizeof(uint32_t))
+		fwrite(padding, 1, sizeof(uint32_t) - str_length % sizeof(uint32_t), file);
 
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IR000)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg = lasm_get_reg(lasm_tokenval.buffer);
-			fprintf(lasm.output_file, "%02x%01x00000\n", lasm_mnemdefs[mnem_idx].opcode, reg);
-		}
+	int ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
 
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IVVVV)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_INTEGER);
-			fprintf(lasm.output_file, "%02x%06x\n", lasm_mnemdefs[mnem_idx].opcode, lasm_tokenval.integer);
-		}
+// close the assembler
+void lasm_close(lasm_t* as)
+{
+	free(as->symbols.pcs);
+	free(as->symbols.labels);
+
+	as->symbols.labels = NULL;
+	as->symbols.pcs = NULL;
+
+	lasm_table_free(&as->labels);
+	lasm_table_free(&as->variables);
+	lasm_table_free(&as->literals);
+	lasm_arena_free(as);
+
+	free(as->code);
+	as->code = NULL;
+
+	free(as->data);
+	as->data = NULL;
+	as->data_length = 0;
+	as->data_capacity = 0;
+
+	free(as->ir);
+	as->ir = NULL;
+	as->ir_length = 0;
+	as->ir_capacity = 0;
+
+	free(as->fixups);
+	as->fixups = NULL;
+	as->fixup_length = 0;
+	as->fixup_capacity = 0;
+
+	free(as->scratch);
+	as->scratch = NULL;
+	as->scratch_capacity = 0;
+}
 
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRR00)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg2 = lasm_get_reg(lasm_tokenval.buffer);
-			fprintf(lasm.output_file, "%02x%01x%01x0000\n", lasm_mnemdefs[mnem_idx].opcode, reg, reg2);
-		}
+// private: whether a fixed size name field holds the given name
+static int lasm_name_is(const char* field, size_t max, const char* name, size_t length)
+{
+	return length <= max && !memcmp(field, name, length) && (length == max || field[length] == '\0');
+}
 
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRRR0)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg2 = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg3 = lasm_get_reg(lasm_tokenval.buffer);
-			fprintf(lasm.output_file, "%02x%01x%01x%01x000\n", lasm_mnemdefs[mnem_idx].opcode, reg, reg2, reg3);
-		}
+// gets register index given register name
+int lasm_get_reg(lasm_t* as, const char* name, size_t length)
+{
+	int index = as->reg_slots[lasm_hash(as->reg_seed, name, length) & (REG_SLOTS - 1)];
+	if(index >= 0 && lasm_name_is(lasm_regdefs[index].name, MAX_REGCHARS, name, length))
+		return index;
 
-		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRRRR)
-		{
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg2 = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg3 = lasm_get_reg(lasm_tokenval.buffer);
-			lasm_read_token();
-			lasm_expect_token_type(TOKEN_REGISTER);
-			uint8_t reg4 = lasm_get_reg(lasm_tokenval.buffer);
-			fprintf(lasm.output_file, "%02x%01x%01x%01x%01x00\n", lasm_mnemdefs[mnem_idx].opcode, reg, reg2, reg3, reg4);
-		}
-	}
-	else if(lasm_tokenval.type == TOKEN_STRING)
-		lasm_output_string(lasm_tokenval.buffer, lasm_tokenval.length);
+	fprintf(stderr, "ERROR: Attempted to access non-existent register (%.*s)\n", (int)length, name);
+	++as->errors;
+	return -1;
+}
+
+// gets mnemonic index given mnem name (returns -1 if there is no such mnemonic)
+int lasm_get_mnem(lasm_t* as, const char* name, size_t length)
+{
+	int index = as->mnem_slots[lasm_hash(as->mnem_seed, name, length) & (MNEM_SLOTS - 1)];
+	if(index >= 0 && lasm_name_is(lasm_mnemdefs[index].name, MAX_MNEMCHARS, name, length))
+		return index;
+
+	fprintf(stderr, "ERROR: Attempted to use non-existent mnemonic (%.*s)\n", (int)length, name);
+	++as->errors;
+	return -1;
+}
+
+// gets instruction location given label name
+size_t lasm_get_pc_from_label(lasm_t* as, const char* label, size_t length)
+{
+	lasm_entry_t* entry = lasm_table_get(&as->labels, label, length);
+	return entry ? entry->value : 0;
+}
+
+// puts a label in the symbol table
+void lasm_symtable_put_label(lasm_t* as, const char* label, size_t length, size_t pc)
+{
+	lasm_entry_t* entry = lasm_table_put(as, &as->labels, label, length, pc);
+	if(!entry)
+	{
+		fprintf(stderr, "ERROR: Out of memory while adding label (%.*s)\n", (int)length, label);
+		++as->errors;
+		return;
+	}
+
+	if(!lasm_symtable_extend(as))
+	{
+		fprintf(stderr, "ERROR: Out of memory while adding label (%.*s)\n", (int)length, label);
+		++as->errors;
+		return;
+	}
+
+	as->symbols.labels[as->symbols.length] = entry->name;
+	as->symbols.pcs[as->symbols.length] = pc;
+	++as->symbols.length;
+}
+
+// private: extends the assemblers symbol table so that another label fits (returns false if unsuccessful)
+int lasm_symtable_extend(lasm_t* as)
+{
+	while(as->symbols.length >= as->symbols.capacity)
+	{
+		size_t capacity = as->symbols.capacity ? as->symbols.capacity * 2 : 2;
+		const char** labels = realloc(as->symbols.labels, capacity * sizeof(const char*));
+		if(!labels) return 0;
+		as->symbols.labels = labels;
+
+		size_t* pcs = realloc(as->symbols.pcs, capacity * sizeof(size_t));
+		if(!pcs) return 0;
+		as->symbols.pcs = pcs;
+		as->symbols.capacity = capacity;
+	}
 	return 1;
 }
 
-int main(int argc, char* argv[])
+// prints the symbol table
+void lasm_symtable_debug(lasm_t* as)
+{
+	unsigned int i; for(i = 0; i < as->symbols.length; i++)
+		printf("label %s at pc %u\n", as->symbols.labels[i], as->symbols.pcs[i]);
+}
+
+// private: get the character an escape sequence stands for (unknown sequences stand for the character itself)
+static char lasm_escape(char c)
 {
-	if(argc >= 3)
+	switch(c)
 	{
-		int append = 0;
-		size_t reloc_pc = 0;
+	case 'n': return '\n';
+	case 'r': return '\r';
+	case 't': return '\t';
+	case '0': return '\0';
+	}
+	return c;
+}
 
-		lasm_init_symtable();
-		
-		// build symtable from both files
-		unsigned int i; for(i = 2; i < argc; i++)
-		{
-			lasm_init(argv[i], argv[1], append, reloc_pc);
-			lasm_symtable_build(&reloc_pc);
-			lasm_close_files();
-		}
+// lex a string into the token (the token points into the source unless the string holds escape sequences, in
+// which case the string is copied into the scratch buffer)
+void lasm_lex_string(lasm_t* as)
+{
+	const char* cur = as->cur;
+	const char* end = as->end;
+	const char* start = cur;
 
-		lasm_symtable_debug();
+	while(cur < end && *cur != '"' && *cur != '\\')
+	{
+		if(*cur == '\n') ++as->lineno;
+		++cur;
+	}
+
+	if(cur >= end || *cur == '"')
+	{
+		as->token.text = start;
+		as->token.length = cur - start;
+		as->cur = cur < end ? cur + 1 : cur;
+		return;
+	}
 
-		// reset the relocation program counter
-		reloc_pc = 0;
+	// once the scratch buffer cannot grow, the rest of the string is skipped
+	size_t length = 0;
+	int full = 0;
+	cur = start;
+	while(cur < end && *cur != '"')
+	{
+		char c = *cur++;
+		if(c == '\\' && cur < end)
+			c = lasm_escape(*cur++);
+		else if(c == '\n')
+			++as->lineno;
 
-		// output the object files given the symbol data
-		for(i = 2; i < argc; i++)
+		if(length >= as->scratch_capacity && !full)
 		{
-			lasm_init(argv[i], argv[1], append, reloc_pc);
-			while(lasm_parse_token(&reloc_pc));
-			lasm_close_files();
-
-			append = 1;
+			size_t capacity = as->scratch_capacity ? as->scratch_capacity * 2 : 0x100;
+			char* scratch = realloc(as->scratch, capacity);
+			if(scratch)
+			{
+				as->scratch = scratch;
+				as->scratch_capacity = capacity;
+			}
+			else
+			{
+				fprintf(stderr, "ERROR: At line %i\nOut of memory while reading string\n", as->lineno);
+				++as->errors;
+				full = 1;
+			}
 		}
-
-		lasm_close();
-		return 0;
+		if(length < as->scratch_capacity)
+			as->scratch[length++] = c;
 	}
-	fprintf(stderr, "invalid arguments to cmd line!\n");
-	return 1;
-}
\ No newline at end of file
+
+	as->token.text = as->scratch;
+	as->token.length = length;
+	as->cur = cur < end ? cur + 1 : cur;
+}	
+
+// outputs a string as a series of instructions
+void lasm_output_string(lasm_t* as, const char* str, size_t len)
+{
+	lasm_ir_t ir;
+	lasm_ir_init(&ir, PUSHI_OPCODE);
+
+	// the string is pushed in reverse after two null terminators, so that its first character ends up on top
+	lasm_emit_ir(as, &ir);
+	lasm_emit_ir(as, &ir);
+
+	size_t pos = len;
+	while(pos > 0)
+	{
+		ir.integer = (unsigned char)str[--pos];
+		lasm_emit_ir(as, &ir);
+	}
+}
+
+// private: get the end of a name (letters, digits and underscores if underscores is set)
+static const char* lasm_lex_name(lasm_t* as, const char* cur, int underscores)
+{
+	while(cur < as->end && (isalnum((unsigned char)*cur) || (underscores && *cur == '_')))
+		++cur;
+	return cur;
+}
+
+// read a token from the assemblers input (returns false once the input is exhausted)
+int lasm_read_token(lasm_t* as)
+{
+	const char* end = as->end;
+
+	while(as->cur < end)
+	{
+		const char* cur = as->cur;
+		char c = *cur;
+
+		if(isspace((unsigned char)c))
+		{
+			if(c == '\n') ++as->lineno;
+			as->cur = cur + 1;
+			continue;
+		}
+
+		if(c == ';')
+		{
+			// comments run until the next ;
+			++cur;
+			while(cur < end && *cur != ';')
+			{
+				if(*cur == '\n') ++as->lineno;
+				++cur;
+			}
+			as->cur = cur < end ? cur + 1 : cur;
+			continue;
+		}
+
+		if(isalpha((unsigned char)c))
+		{
+			as->cur = lasm_lex_name(as, cur, 1);
+			as->token.text = cur;
+			as->token.length = as->cur - cur;
+
+			if(as->cur < end && *as->cur == ':')
+			{
+				as->token.type = TOKEN_LABEL;
+				++as->cur;
+			}
+			else
+				as->token.type = TOKEN_INSTR;
+		}
+		else if(c == '%')
+		{
+			as->cur = lasm_lex_name(as, cur + 1, 0);
+			as->token.text = cur + 1;
+			as->token.length = as->cur - (cur + 1);
+			as->token.type = TOKEN_REGISTER;
+		}
+		else if(c == '"')
+		{
+			as->cur = cur + 1;
+			lasm_lex_string(as);
+			as->token.type = TOKEN_STRING;
+		}
+		else if(isdigit((unsigned char)c) || (c == '-' && cur + 1 < end && isdigit((unsigned char)cur[1])))
+		{
+			// decimal, or hexadecimal after 0x, optionally negated (any value of a register's width can be written,
+			// unsigned values above the largest signed one wrap around to negative ones)
+			int negative = c == '-';
+			if(negative) ++cur;
+
+			unsigned int base = 10;
+			if(*cur == '0' && cur + 2 < end && (cur[1] == 'x' || cur[1] == 'X') && isxdigit((unsigned char)cur[2]))
+			{
+				base = 16;
+				cur += 2;
+			}
+
+			uintptr_t value = 0;
+			int overflow = 0;
+			while(cur < end && (base == 16 ? isxdigit((unsigned char)*cur) : isdigit((unsigned char)*cur)))
+			{
+				int digit = tolower((unsigned char)*cur++);
+				unsigned int number = isdigit(digit) ? digit - '0' : digit - 'a' + 10;
+
+				if(value > (UINTPTR_MAX - number) / base)
+					overflow = 1;
+				value = value * base + number;
+			}
+
+			if(overflow || (negative && value > (uintptr_t)INTPTR_MAX + 1))
+			{
+				fprintf(stderr, "ERROR: At line %i\nInteger literal out of range (%.*s)\n", as->lineno,
+					(int)(cur - as->cur), as->cur);
+				++as->errors;
+			}
+
+			as->token.text = as->cur;
+			as->token.length = cur - as->cur;
+			as->cur = cur;
+			as->token.type = TOKEN_INTEGER;
+			as->token.integer = (intptr_t)(negative ? 0 - value : value);
+			as->token.label = 0;
+			as->token.variable = 0;
+		}
+		else if(c == '@')
+		{
+			as->cur = lasm_lex_name(as, cur + 1, 1);
+			as->token.text = cur + 1;
+			as->token.length = as->cur - (cur + 1);
+			as->token.type = TOKEN_INTEGER;
+
+			// labels defined further on are patched once everything is assembled
+			lasm_entry_t* entry = lasm_table_get(&as->labels, as->token.text, as->token.length);
+			as->token.integer = entry ? entry->value : 0;
+			as->token.label = 1;
+			as->token.variable = 0;
+			as->token.resolved = entry != NULL;
+		}
+		else if(c == '#')
+		{
+			as->cur = lasm_lex_name(as, cur + 1, 1);
+			as->token.text = cur + 1;
+			as->token.length = as->cur - (cur + 1);
+			as->token.type = TOKEN_INTEGER;
+			as->token.integer = lasm_variable_get(as, as->token.text, as->token.length);
+			as->token.label = 0;
+			as->token.variable = 1;
+		}
+		else if(c == '\'')
+		{
+			// 'c' or an escape sequence like '\n'
+			++cur;
+			char value = cur < end ? *cur++ : '\0';
+			if(value == '\\' && cur < end)
+				value = lasm_escape(*cur++);
+
+			as->token.text = as->cur;
+			as->token.length = cur - as->cur;
+			as->cur = cur < end ? cur + 1 : cur;
+			as->token.type = TOKEN_INTEGER;
+			as->token.integer = value;
+			as->token.label = 0;
+			as->token.variable = 0;
+		}
+		else
+		{
+			fprintf(stderr, "ERROR: At line %i\nUnexpected character '%c'\n", as->lineno, c);
+			++as->errors;
+			as->cur = cur + 1;
+			continue;
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// read the next token and check its type (returns true if it has the expected type)
+int lasm_expect_token(lasm_t* as, lasm_tokentype type)
+{
+	if(!lasm_read_token(as))
+	{
+		fprintf(stderr, "ERROR: At line %i\nUnexpected end of input\n", as->lineno);
+		++as->errors;
+		return 0;
+	}
+
+	if(as->token.type != type)
+	{
+		fprintf(stderr, "ERROR: At line %i\nExpected token type %i, but received %i\n", as->lineno, type, as->token.type);
+		++as->errors;
+		return 0;
+	}
+	return 1;
+}
+
+// private: report an integer literal which does not fit the immediate of its instruction (mov takes any value and the
+// branches any location, as they have wide forms)
+static void lasm_check_immediate(lasm_t* as, const lasm_ir_t* ir)
+{
+	if(as->token.label || as->token.variable || lasm_ir_words(ir, ir->integer)) return;
+
+	fprintf(stderr, "ERROR: At line %i\nImmediate out of range (%li)\n", as->lineno, (long)ir->integer);
+	++as->errors;
+}
+
+// parse a token from the assemblers and spit an opcode into the output (or into the ir when optimizing)
+int lasm_parse_token(lasm_t* as)
+{
+	int parse = lasm_read_token(as);
+
+	if(!parse) return 0;
+
+	if(as->token.type == TOKEN_LABEL)
+		lasm_symtable_put_label(as, as->token.text, as->token.length, lasm_pc(as));
+	else if(as->token.type == TOKEN_INSTR)
+	{
+		int mnem_idx = lasm_get_mnem(as, as->token.text, as->token.length);
+		if(mnem_idx < 0) return 1;
+
+		lasm_ir_t ir;
+		lasm_ir_init(&ir, lasm_mnemdefs[mnem_idx].opcode);
+		
+		if(ir.opcode == STR)
+		{
+			// str takes a string literal, which goes into the data section
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_STRING)) return 1;
+			ir.integer = lasm_data_literal(as, as->token.text, as->token.length);
+		}
+		else if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRVVV)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_INTEGER)) return 1;
+			ir.integer = as->token.integer;
+			ir.label = as->token.label;
+			lasm_add_reference(as);
+			lasm_check_immediate(as, &ir);
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IR000)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IVVVV)
+		{
+			if(!lasm_expect_token(as, TOKEN_INTEGER)) return 1;
+			ir.integer = as->token.integer;
+			ir.label = as->token.label;
+			lasm_add_reference(as);
+			lasm_check_immediate(as, &ir);
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRR00)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[1] = lasm_get_reg(as, as->token.text, as->token.length);
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRRR0)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[1] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[2] = lasm_get_reg(as, as->token.text, as->token.length);
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRRV)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[1] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_INTEGER)) return 1;
+			ir.integer = as->token.integer;
+			ir.label = as->token.label;
+			lasm_add_reference(as);
+
+			// the offset is a signed 16 bit value
+			if(!as->token.label && !as->token.variable && (ir.integer < INT16_MIN || ir.integer > INT16_MAX))
+			{
+				fprintf(stderr, "ERROR: At line %i\nOffset out of range (%li)\n", as->lineno, (long)ir.integer);
+				++as->errors;
+			}
+		}
+
+		if(lasm_mnemdefs[mnem_idx].optype == OPTYPE_IRRRR)
+		{
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[0] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[1] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[2] = lasm_get_reg(as, as->token.text, as->token.length);
+			if(!lasm_expect_token(as, TOKEN_REGISTER)) return 1;
+			ir.regs[3] = lasm_get_reg(as, as->token.text, as->token.length);
+		}
+
+		lasm_emit_ir(as, &ir);
+	}
+	else if(as->token.type == TOKEN_STRING)
+		lasm_output_string(as, as->token.text, as->token.length);
+	return 1;
+}
+
+// private: whether an opcode's immediate is a location in the program
+static int lasm_opt_is_branch(uint8_t op)
+{
+	switch(op)
+	{
+	case JMP: case JNZ: case JZ: case JNE: case JE: case JGT: case JLT: case JGE: case JLE: case JSR: case RET:
+		return 1;
+	}
+	return 0;
+}
+
+// private: whether an instruction's immediate is a location in the program (which moves with the code)
+static int lasm_opt_is_location(const lasm_ir_t* ir)
+{
+	return (ir->label || lasm_opt_is_branch(ir->opcode)) && ir->integer >= 0;
+}
+
+// private: whether an instruction ends a basic block
+static int lasm_opt_ends_block(uint8_t op)
+{
+	return op == HALT || lasm_opt_is_branch(op);
+}
+
+// private: whether an instruction only writes its first register (so it can be removed if that value is never used)
+static int lasm_opt_is_pure(uint8_t op)
+{
+	switch(op)
+	{
+	case MOV: case ADD: case SUB: case MUL: case NEG: case MOVR: case GET: case GETA: case DREF: case ASL: case ASR: case MASK:
+	case STR: case LD8: case LD16: case LD32: case LD64:
+		return 1;
+	}
+	return 0;
+}
+
+// private: whether writes to a register are discarded by the vm (the zero and stack length registers)
+static int lasm_opt_is_sink(uint8_t reg)
+{
+	return reg == ZERO_REG || reg == ESL_REG;
+}
+
+// private: get the register an instruction writes (returns -1 if it writes none the vm keeps)
+static int lasm_opt_writes(const lasm_ir_t* ir)
+{
+	if((lasm_opt_is_pure(ir->opcode) || ir->opcode == DIV || ir->opcode == POP) && !lasm_opt_is_sink(ir->regs[0]))
+		return ir->regs[0];
+	return -1;
+}
+
+// private: mark the registers an instruction reads
+static void lasm_opt_reads(const lasm_ir_t* ir, int* regs)
+{
+	switch(ir->opcode)
+	{
+	case HALT: case PRT: case PRTC: case JNZ: case JZ: case PUSH: case SET: case NEG:
+		regs[ir->regs[0]] = 1;
+		break;
+	case ADD: case SUB: case MUL: case DIV:
+		regs[ir->regs[1]] = 1;
+		regs[ir->regs[2]] = 1;
+		break;
+	case CMP: case SETV: case ASL: case ASR: case MASK: case WRT: case ST8: case ST16: case ST32: case ST64:
+		regs[ir->regs[0]] = 1;
+		regs[ir->regs[1]] = 1;
+		break;
+	case MOVR: case DREF: case LD8: case LD16: case LD32: case LD64:
+		regs[ir->regs[1]] = 1;
+		break;
+	case CALL:
+		{
+			// bound functions may read any register
+			unsigned int i; for(i = 0; i < NUM_REGS; i++)
+				regs[i] = 1;
+		}
+		break;
+	}
+}
+
+// private: get the first instruction that was not removed at or after pc (returns the program length if there is none)
+static size_t lasm_opt_next(lasm_t* as, size_t pc)
+{
+	while(pc < as->ir_length && as->ir[pc].dead)
+		++pc;
+	return pc < as->ir_length ? pc : as->ir_length;
+}
+
+// private: get the instruction a branch (or label valued immediate) lands on
+static size_t lasm_opt_target(lasm_t* as, const lasm_ir_t* ir)
+{
+	if(ir->integer < 0 || (size_t)ir->integer > as->ir_length) return as->ir_length;
+	return lasm_opt_next(as, ir->integer);
+}
+
+// private: mark the first instruction of every basic block (the program length marks the end of the program)
+static void lasm_opt_leaders(lasm_t* as, uint8_t* leaders)
+{
+	memset(leaders, 0, as->ir_length + 1);
+	leaders[lasm_opt_next(as, 0)] = 1;
+	leaders[as->ir_length] = 1;
+
+	size_t i; for(i = 0; i < as->ir_length; i++)
+	{
+		const lasm_ir_t* ir = &as->ir[i];
+		if(ir->dead) continue;
+
+		if((lasm_opt_is_branch(ir->opcode) && ir->opcode != RET) || ir->label)
+			leaders[lasm_opt_target(as, ir)] = 1;
+		if(lasm_opt_ends_block(ir->opcode))
+			leaders[lasm_opt_next(as, i + 1)] = 1;
+	}
+}
+
+// private: remove an instruction (returns true so callers can record the change)
+static int lasm_opt_remove(lasm_ir_t* ir)
+{
+	ir->dead = 1;
+	return 1;
+}
+
+// private: record that an instruction stores a known value into a register, replacing it with a move of that value
+// (or removing it if the register already holds the value), returns true if the instruction changed
+static int lasm_opt_known(lasm_ir_t* ir, int* known, intptr_t* values, uint8_t reg, intptr_t value)
+{
+	int changed = 0;
+
+	if(known[reg] && values[reg] == value)
+		changed = lasm_opt_remove(ir);
+	else if(ir->opcode != MOV && value >= 0 && value <= IMMVL_MASK)
+	{
+		lasm_ir_init(ir, MOV);
+		ir->regs[0] = reg;
+		ir->integer = value;
+		changed = 1;
+	}
+
+	known[reg] = 1;
+	values[reg] = value;
+	return changed;
+}
+
+// private: replace a conditional branch whose outcome is known with a jump or remove it (returns true)
+static int lasm_opt_resolve_branch(lasm_ir_t* ir, int taken)
+{
+	if(!taken) return lasm_opt_remove(ir);
+
+	intptr_t target = ir->integer;
+	int label = ir->label;
+	lasm_ir_init(ir, JMP);
+	ir->integer = target;
+	ir->label = label;
+	return 1;
+}
+
+// private: propagate constants through each basic block, folding arithmetic and branches on known values and
+// removing moves of values registers already hold (returns true if anything changed)
+static int lasm_opt_fold(lasm_t* as, const uint8_t* leaders)
+{
+	int changed = 0;
+	int known[NUM_REGS];
+	intptr_t values[NUM_REGS];
+	int cmp_known = 0;
+	intptr_t cmp1 = 0;
+	intptr_t cmp2 = 0;
+
+	size_t i; for(i = 0; i < as->ir_length; i++)
+	{
+		lasm_ir_t* ir = &as->ir[i];
+
+		// nothing is known on entry to a block except for the zero register
+		if(leaders[i])
+		{
+			memset(known, 0, sizeof(known));
+			known[ZERO_REG] = 1;
+			values[ZERO_REG] = 0;
+			cmp_known = 0;
+		}
+
+		if(ir->dead) continue;
+
+		uint8_t d = ir->regs[0];
+		uint8_t a = ir->regs[1];
+		uint8_t b = ir->regs[2];
+
+		// results stored in the zero or stack length registers are discarded
+		if(lasm_opt_is_pure(ir->opcode) && lasm_opt_is_sink(d))
+		{
+			changed |= lasm_opt_remove(ir);
+			continue;
+		}
+
+		switch(ir->opcode)
+		{
+		case MOV:
+			if(ir->label)
+				known[d] = 0;
+			else
+				changed |= lasm_opt_known(ir, known, values, d, ir->integer);
+			break;
+		case ADD: case SUB: case MUL:
+			if(known[a] && known[b])
+			{
+				uintptr_t x = values[a], y = values[b];
+				uintptr_t v = ir->opcode == ADD ? x + y : ir->opcode == SUB ? x - y : x * y;
+				changed |= lasm_opt_known(ir, known, values, d, (intptr_t)v);
+				break;
+			}
+
+			// adding zero (or multiplying by one) is a move
+			if((ir->opcode != MUL && known[b] && values[b] == 0) || (ir->opcode == MUL && known[b] && values[b] == 1))
+				b = a;
+			else if((ir->opcode == ADD && known[a] && values[a] == 0) || (ir->opcode == MUL && known[a] && values[a] == 1))
+				;
+			else
+			{
+				known[d] = 0;
+				break;
+			}
+
+			lasm_ir_init(ir, MOVR);
+			ir->regs[0] = d;
+			ir->regs[1] = b;
+			changed = 1;
+			if(d == b)
+				lasm_opt_remove(ir);
+			known[d] = 0;
+			break;
+		case DIV:
+			if(lasm_opt_is_sink(d)) break;
+			if(known[a] && known[b] && values[b] != 0 && !(values[a] == INTPTR_MIN && values[b] == -1))
+				changed |= lasm_opt_known(ir, known, values, d, values[a] / values[b]);
+			else
+				known[d] = 0;
+			break;
+		case NEG:
+			if(known[d])
+				changed |= lasm_opt_known(ir, known, values, d, (intptr_t)(0 - (uintptr_t)values[d]));
+			break;
+		case ASL: case ASR:
+			if(known[d] && known[a] && values[a] >= 0 && values[a] < (intptr_t)(sizeof(intptr_t) * 8))
+			{
+				intptr_t v = ir->opcode == ASL ? (intptr_t)((uintptr_t)values[d] << values[a]) : values[d] >> values[a];
+				changed |= lasm_opt_known(ir, known, values, d, v);
+			}
+			else
+				known[d] = 0;
+			break;
+		case MASK:
+			if(known[d] && known[a])
+				changed |= lasm_opt_known(ir, known, values, d, values[d] & values[a]);
+			else
+				known[d] = 0;
+			break;
+		case MOVR:
+			if(d == a)
+				changed |= lasm_opt_remove(ir);
+			else if(known[a])
+				changed |= lasm_opt_known(ir, known, values, d, values[a]);
+			else
+				known[d] = 0;
+			break;
+		case GET: case GETA: case DREF: case POP: case STR: case LD8: case LD16: case LD32: case LD64:
+			if(!lasm_opt_is_sink(d))
+				known[d] = 0;
+			break;
+		case CALL:
+			// bound functions may change any register
+			memset(known, 0, sizeof(known));
+			known[ZERO_REG] = 1;
+			break;
+		case CMP:
+			cmp_known = known[d] && known[a];
+			cmp1 = values[d];
+			cmp2 = values[a];
+			break;
+		case JNE: case JE: case JGT: case JLT: case JGE: case JLE:
+			if(cmp_known)
+			{
+				int taken = ir->opcode == JNE ? cmp1 != cmp2 : ir->opcode == JE ? cmp1 == cmp2 :
+					ir->opcode == JGT ? cmp1 > cmp2 : ir->opcode == JLT ? cmp1 < cmp2 :
+					ir->opcode == JGE ? cmp1 >= cmp2 : cmp1 <= cmp2;
+				changed |= lasm_opt_resolve_branch(ir, taken);
+			}
+			break;
+		case JNZ: case JZ:
+			if(known[d])
+				changed |= lasm_opt_resolve_branch(ir, ir->opcode == JNZ ? values[d] != 0 : values[d] == 0);
+			break;
+		}
+	}
+
+	return changed;
+}
+
+// private: remove stores to registers which are overwritten before they are read within the same basic block
+// (every register is treated as read where a block ends), returns true if anything changed
+static int lasm_opt_dead_stores(lasm_t* as, const uint8_t* leaders)
+{
+	int changed = 0;
+	int live[NUM_REGS];
+	int boundary = 1;
+
+	size_t i = as->ir_length; while(i-- > 0)
+	{
+		lasm_ir_t* ir = &as->ir[i];
+
+		if(!ir->dead)
+		{
+			if(boundary || lasm_opt_ends_block(ir->opcode) || ir->opcode == CALL)
+			{
+				unsigned int r; for(r = 0; r < NUM_REGS; r++)
+					live[r] = 1;
+			}
+			boundary = 0;
+
+			int reg = lasm_opt_writes(ir);
+			if(lasm_opt_is_pure(ir->opcode) && (reg < 0 || !live[reg]))
+				changed |= lasm_opt_remove(ir);
+			else
+			{
+				if(reg >= 0)
+					live[reg] = 0;
+				lasm_opt_reads(ir, live);
+			}
+		}
+
+		// whatever comes before the start of a block ends one
+		if(leaders[i])
+			boundary = 1;
+	}
+
+	return changed;
+}
+
+// private: replace a push followed by a pop within the same basic block (with nothing in between that uses the stack
+// or changes the pushed register) with a move (returns true if anything changed)
+static int lasm_opt_push_pop(lasm_t* as, const uint8_t* leaders)
+{
+	int changed = 0;
+
+	size_t i; for(i = 0; i < as->ir_length; i++)
+	{
+		lasm_ir_t* push = &as->ir[i];
+		if(push->dead || (push->opcode != PUSH && push->opcode != PUSHI)) continue;
+
+		lasm_ir_t* pop = NULL;
+		size_t j; for(j = i + 1; j < as->ir_length && !leaders[j]; j++)
+		{
+			lasm_ir_t* ir = &as->ir[j];
+			if(ir->dead) continue;
+
+			if(ir->opcode == POP)
+			{
+				pop = ir;
+				break;
+			}
+
+			int reads[NUM_REGS] = {0};
+			lasm_opt_reads(ir, reads);
+
+			if(lasm_opt_ends_block(ir->opcode) || ir->opcode == PUSH || ir->opcode == PUSHI || ir->opcode == CALL ||
+				reads[ESL_REG] || (push->opcode == PUSH && lasm_opt_writes(ir) == push->regs[0]))
+				break;
+		}
+
+		if(!pop) continue;
+
+		uint8_t reg = pop->regs[0];
+		changed |= lasm_opt_remove(push);
+
+		if(lasm_opt_is_sink(reg) || (push->opcode == PUSH && push->regs[0] == reg))
+			lasm_opt_remove(pop);
+		else if(push->opcode == PUSH)
+		{
+			lasm_ir_init(pop, MOVR);
+			pop->regs[0] = reg;
+			pop->regs[1] = push->regs[0];
+		}
+		else
+		{
+			lasm_ir_init(pop, MOV);
+			pop->regs[0] = reg;
+			pop->integer = push->integer;
+			pop->label = push->label;
+		}
+	}
+
+	return changed;
+}
+
+// private: mark every instruction which can be reached from the start of the program by following branches, calls
+// (whose routine returns to the instruction after them) and label valued immediates (returns true if successful)
+static int lasm_opt_reach(lasm_t* as, uint8_t* reached)
+{
+	size_t n = as->ir_length;
+	size_t* work = malloc((n + 1) * sizeof(size_t));
+	size_t count = 0;
+
+	if(!work) return 0;
+	memset(reached, 0, n + 1);
+
+	// code whose location is used as a value is kept as well
+	work[count++] = lasm_opt_next(as, 0);
+	reached[work[0]] = 1;
+
+	size_t i; for(i = 0; i < n; i++)
+	{
+		const lasm_ir_t* ir = &as->ir[i];
+		size_t target = lasm_opt_target(as, ir);
+		if(!ir->dead && ir->label && !lasm_opt_is_branch(ir->opcode) && !reached[target])
+		{
+			reached[target] = 1;
+			work[count++] = target;
+		}
+	}
+
+	while(count)
+	{
+		i = work[--count];
+		if(i >= n) continue;
+
+		const lasm_ir_t* ir = &as->ir[i];
+		size_t next[2];
+		unsigned int nexts = 0;
+
+		if(lasm_opt_is_branch(ir->opcode) && ir->opcode != RET)
+			next[nexts++] = lasm_opt_target(as, ir);
+		if(ir->opcode != HALT && ir->opcode != JMP && ir->opcode != RET)
+			next[nexts++] = lasm_opt_next(as, i + 1);
+
+		unsigned int k; for(k = 0; k < nexts; k++)
+		{
+			if(!reached[next[k]])
+			{
+				reached[next[k]] = 1;
+				work[count++] = next[k];
+			}
+		}
+	}
+
+	free(work);
+	return 1;
+}
+
+// private: remove instructions that cannot be reached from the start of the program (returns true if anything changed)
+static int lasm_opt_unreachable(lasm_t* as)
+{
+	size_t n = as->ir_length;
+	uint8_t* reached = malloc(n + 1);
+	int changed = 0;
+
+	if(!reached || !lasm_opt_reach(as, reached))
+	{
+		free(reached);
+		return 0;
+	}
+
+	size_t i; for(i = 0; i < n; i++)
+	{
+		if(!as->ir[i].dead && !reached[i])
+			changed |= lasm_opt_remove(&as->ir[i]);
+	}
+
+	free(reached);
+	return changed;
+}
+
+// private: remove jumps to the instruction right after them (returns true if anything changed)
+static int lasm_opt_jumps(lasm_t* as)
+{
+	int changed = 0;
+
+	size_t i; for(i = 0; i < as->ir_length; i++)
+	{
+		lasm_ir_t* ir = &as->ir[i];
+		if(ir->dead || !lasm_opt_is_branch(ir->opcode) || ir->opcode == JSR || ir->opcode == RET) continue;
+
+		if(lasm_opt_target(as, ir) == lasm_opt_next(as, i + 1))
+			changed |= lasm_opt_remove(ir);
+	}
+
+	return changed;
+}
+
+// private: drop removed instructions, moving branch targets, label valued immediates and the symbol table along
+static void lasm_opt_compact(lasm_t* as)
+{
+	size_t n = as->ir_length;
+	size_t* newpc = malloc((n + 1) * sizeof(size_t));
+	if(!newpc) return;
+
+	size_t length = 0;
+	size_t i; for(i = 0; i <= n; i++)
+	{
+		newpc[i] = length;
+		if(i < n && !as->ir[i].dead)
+			++length;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		lasm_ir_t* ir = &as->ir[i];
+		if(ir->dead) continue;
+
+		if(lasm_opt_is_location(ir))
+			ir->integer = newpc[(size_t)ir->integer < n ? (size_t)ir->integer : n];
+		as->ir[newpc[i]] = *ir;
+	}
+
+	for(i = 0; i < as->symbols.length; i++)
+		as->symbols.pcs[i] = newpc[as->symbols.pcs[i] < n ? as->symbols.pcs[i] : n];
+
+	as->ir_length = length;
+	free(newpc);
+}
+
+// strip the routines which can never be reached from the start of the program and drop their labels (the
+// instructions are left for lasm_opt_compact to remove)
+void lasm_strip(lasm_t* as)
+{
+	size_t n = as->ir_length;
+	uint8_t* reached = malloc(n + 1);
+
+	if(!reached || !lasm_opt_reach(as, reached))
+	{
+		free(reached);
+		return;
+	}
+
+	size_t i; for(i = 0; i < n; i++)
+	{
+		if(!as->ir[i].dead && !reached[i])
+			lasm_opt_remove(&as->ir[i]);
+	}
+
+	size_t kept = 0;
+	for(i = 0; i < as->symbols.length; i++)
+	{
+		if(as->symbols.pcs[i] < n && !reached[as->symbols.pcs[i]]) continue;
+
+		as->symbols.labels[kept] = as->symbols.labels[i];
+		as->symbols.pcs[kept] = as->symbols.pcs[i];
+		++kept;
+	}
+	as->symbols.length = kept;
+
+	free(reached);
+}
+
+// optimize the intermediate program by propagating constants, removing dead stores, cancelling push/pop pairs and
+// removing unreachable code over its basic blocks until nothing changes, then drop the removed instructions
+void lasm_optimize(lasm_t* as)
+{
+	uint8_t* leaders = malloc(as->ir_length + 1);
+	if(!leaders) return;
+
+	unsigned int round; for(round = 0; round < MAX_OPT_ROUNDS; round++)
+	{
+		int changed = 0;
+
+		lasm_opt_leaders(as, leaders);
+		changed |= lasm_opt_fold(as, leaders);
+		lasm_opt_leaders(as, leaders);
+		changed |= lasm_opt_dead_stores(as, leaders);
+		lasm_opt_leaders(as, leaders);
+		changed |= lasm_opt_push_pop(as, leaders);
+		changed |= lasm_opt_unreachable(as);
+		changed |= lasm_opt_jumps(as);
+
+		if(!changed) break;
+	}
+
+	free(leaders);
+	lasm_opt_compact(as);
+}
+
+// private: encode the intermediate program, giving each mov and branch whose immediate does not fit its word the wide
+// form (a branch growing moves every location after it, so the lengths are widened until all of them fit), locations
+// in immediates and in the symbol table turn from instruction indices into word locations
+static void lasm_relax(lasm_t* as)
+{
+	size_t n = as->ir_length;
+	uint8_t* lengths = malloc(n + 1);
+	size_t* pcs = malloc((n + 1) * sizeof(size_t));
+	if(!lengths || !pcs)
+	{
+		fprintf(stderr, "ERROR: Out of memory while encoding the program\n");
+		++as->errors;
+		free(lengths);
+		free(pcs);
+		return;
+	}
+
+	size_t i; for(i = 0; i < n; i++)
+	{
+		const lasm_ir_t* ir = &as->ir[i];
+		size_t words = lasm_opt_is_location(ir) ? 1 : lasm_ir_words(ir, ir->integer);
+		lengths[i] = words ? words : 1;
+	}
+
+	int changed = 1;
+	while(changed)
+	{
+		changed = 0;
+
+		size_t pc = 0;
+		for(i = 0; i <= n; i++)
+		{
+			pcs[i] = pc;
+			if(i < n) pc += lengths[i];
+		}
+
+		// every location fits the shortest immediate as long as the whole program does
+		if(pc <= IMMVL_MASK) break;
+
+		for(i = 0; i < n; i++)
+		{
+			const lasm_ir_t* ir = &as->ir[i];
+			if(!lasm_opt_is_location(ir)) continue;
+
+			size_t words = lasm_ir_words(ir, pcs[(size_t)ir->integer < n ? (size_t)ir->integer : n]);
+			if(words > lengths[i])
+			{
+				lengths[i] = words;
+				changed = 1;
+			}
+		}
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		lasm_ir_t ir = as->ir[i];
+		if(lasm_opt_is_location(&ir))
+			ir.integer = pcs[(size_t)ir.integer < n ? (size_t)ir.integer : n];
+
+		word_t words[3];
+		lasm_encode(&ir, lengths[i], words);
+		size_t j; for(j = 0; j < lengths[i]; j++)
+			lasm_emit(as, words[j]);
+	}
+
+	for(i = 0; i < as->symbols.length; i++)
+		as->symbols.pcs[i] = pcs[as->symbols.pcs[i] < n ? as->symbols.pcs[i] : n];
+
+	free(lengths);
+	free(pcs);
+}
+
+// whether a file name ends in an extension
+int lasm_has_extension(const char* name, const char* ext)
+{
+	size_t len = strlen(name);
+	size_t ext_len = strlen(ext);
+	return len >= ext_len && !strcmp(name + len - ext_len, ext);
+}
+
+// finish assembling once every input was read: patch forward references, strip the routines that are never reached
+// when optimizing or stripping, optimize the intermediate program when optimizing and encode it (returns true if no
+// errors were reported)
+int lasm_finish(lasm_t* as)
+{
+	if(as->finished) return !as->errors;
+	as->finished = 1;
+
+	// an object keeps its references until it is linked
+	if(as->relocatable) return !as->errors;
+
+	lasm_resolve_fixups(as);
+
+	if(as->buffered)
+	{
+		if(as->optimize)
+		{
+			lasm_strip(as);
+			lasm_optimize(as);
+		}
+		else if(as->strip)
+		{
+			lasm_strip(as);
+			lasm_opt_compact(as);
+		}
+
+		lasm_relax(as);
+	}
+
+	return !as->errors;
+}
+
+// create an assembler (returns NULL if unsuccessful)
+lasm_t* lasm_create(void)
+{
+	lasm_t* as = calloc(1, sizeof(lasm_t));
+	if(!as) return NULL;
+
+	lasm_init_symtable(as);
+
+	// programs are kept as ir until they are finished, as the encoding of an instruction depends on where its labels
+	// end up
+	as->buffered = 1;
+	return as;
+}
+
+// destroy an assembler (programs returned by lasm_program stay valid)
+void lasm_destroy(lasm_t* as)
+{
+	if(!as) return;
+
+	lasm_close_files(as);
+	lasm_close(as);
+	free(as);
+}
+
+// set whether the program is optimized before it is encoded (must be set before anything is assembled, objects are
+// optimized once they are linked into a program)
+void lasm_setopt(lasm_t* as, int value)
+{
+	as->optimize = value && !as->relocatable;
+}
+
+// set whether routines which are never reached from the start of the program are left out of it (must be set before
+// anything is assembled, optimizing strips them as well)
+void lasm_setstrip(lasm_t* as, int value)
+{
+	as->strip = value && !as->relocatable;
+}
+
+// set whether an object is assembled instead of a program (must be set before anything is assembled)
+void lasm_setreloc(lasm_t* as, int value)
+{
+	as->relocatable = value;
+	as->buffered = !value;
+	if(value) as->optimize = as->strip = 0;
+}
+
+// assemble a source held in memory into the program, labels used before they are defined are patched by lasm_finish
+// (returns true if no errors were reported)
+int lasm_assemble(lasm_t* as, const char* source, size_t length)
+{
+	if(as->finished)
+	{
+		fprintf(stderr, "ERROR: Attempted to assemble into a finished program\n");
+		++as->errors;
+		return 0;
+	}
+
+	int errors = as->errors;
+
+	as->cur = source;
+	as->end = source + length;
+	as->token.text = NULL;
+	as->token.length = 0;
+	as->token.integer = 0;
+	as->lineno = 1;
+
+	while(lasm_parse_token(as));
+
+	as->cur = as->end = NULL;
+	return as->errors == errors;
+}
+
+// assemble a file into the program ("-" reads from stdin), returns true if no errors were reported
+int lasm_assemble_file(lasm_t* as, const char* filename)
+{
+	if(!lasm_open(as, filename))
+	{
+		fprintf(stderr, "ERROR: Could not open input file (%s)\n", filename);
+		++as->errors;
+		return 0;
+	}
+
+	int ok = lasm_assemble(as, as->source, as->source_size);
+	lasm_close_files(as);
+	return ok;
+}
+
+// private: whether a name offset of an object container points at a null terminated name
+static int lasm_obj_name_valid(const lasm_obj_header_t* header, const char* strings, uint32_t name)
+{
+	return name < header->str_length && memchr(strings + name, '\0', header->str_length - name) != NULL;
+}
+
+// private: whether an object container section lies within the container (and is 4 byte aligned)
+static int lasm_obj_section_valid(size_t size, uint32_t offset, uint32_t count, size_t stride)
+{
+	return offset % sizeof(uint32_t) == 0 && offset <= size && count <= (size - offset) / stride;
+}
+
+// link an object container held in memory (4 byte aligned) into the program, its labels and variables become part of
+// the program as if its source was assembled in its place (returns true if successful)
+int lasm_link(lasm_t* as, const void* object, size_t size)
+{
+	const lasm_obj_header_t* header = object;
+	const uint8_t* base = object;
+
+	if(as->finished)
+	{
+		fprintf(stderr, "ERROR: Attempted to link into a finished program\n");
+		++as->errors;
+		return 0;
+	}
+
+	if(size < sizeof(lasm_obj_header_t) || header->magic != LOBJ_MAGIC || header->version != LOBJ_VERSION ||
+		!lasm_obj_section_valid(size, header->code_offset, header->code_length, sizeof(word_t)) ||
+		!lasm_obj_section_valid(size, header->data_offset, header->data_length, 1) ||
+		!lasm_obj_section_valid(size, header->sym_offset, header->sym_count, sizeof(lvm_bin_sym_t)) ||
+		!lasm_obj_section_valid(size, header->reloc_offset, header->reloc_count, sizeof(lasm_obj_reloc_t)) ||
+		!lasm_obj_section_valid(size, header->str_offset, header->str_length, 1))
+	{
+		fprintf(stderr, "ERROR: Invalid object container\n");
+		++as->errors;
+		return 0;
+	}
+
+	const word_t* code = (const word_t*)(base + header->code_offset);
+	const lvm_bin_sym_t* symbols = (const lvm_bin_sym_t*)(base + header->sym_offset);
+	const lasm_obj_reloc_t* relocs = (const lasm_obj_reloc_t*)(base + header->reloc_offset);
+	const char* strings = (const char*)(base + header->str_offset);
+
+	// the instructions of the object are numbered, as locations in the ir are instruction indices (the immediate words
+	// of wide instructions get no number, nothing may refer to them)
+	size_t* index = malloc((header->code_length + 1) * sizeof(size_t));
+	if(!index)
+	{
+		fprintf(stderr, "ERROR: Out of memory while linking\n");
+		++as->errors;
+		return 0;
+	}
+
+	size_t count = 0;
+	uint32_t j; for(j = 0; j < header->code_length; j++)
+	{
+		size_t words = INSTR_WORDS(code[j]);
+		if(words > header->code_length - j) break;
+		if(code[j] >> 24 == STR && (code[j] & IMMVL_MASK) >= header->data_length) break;
+
+		index[j] = count++;
+		while(--words)
+			index[++j] = SIZE_MAX;
+	}
+	index[header->code_length] = count;
+
+	uint32_t i; for(i = 0; j == header->code_length && i < header->sym_count; i++)
+	{
+		if(!lasm_obj_name_valid(header, strings, symbols[i].name) || symbols[i].pc > header->code_length ||
+			index[symbols[i].pc] == SIZE_MAX) break;
+	}
+	if(i == header->sym_count) for(i = 0; i < header->reloc_count; i++)
+	{
+		if(!lasm_obj_name_valid(header, strings, relocs[i].name) || relocs[i].at >= header->code_length ||
+			index[relocs[i].at] == SIZE_MAX) break;
+	}
+	if(j < header->code_length || i < header->sym_count || i < header->reloc_count)
+	{
+		fprintf(stderr, "ERROR: Invalid object container\n");
+		++as->errors;
+		free(index);
+		return 0;
+	}
+
+	// locations in the object move to where it is linked (instruction indices when buffered, words otherwise)
+	size_t pc = lasm_pc(as);
+	if(!as->buffered)
+	{
+		for(j = 0; j <= header->code_length; j++)
+			index[j] = j;
+	}
+
+	// the literals of the object follow the data section of the program, so their offsets move by its length
+	long data = as->data_length;
+	if(header->data_length && (data = lasm_data_append(as, base + header->data_offset, header->data_length)) < 0)
+	{
+		free(index);
+		return 0;
+	}
+
+	for(j = 0; j < header->code_length; j += INSTR_WORDS(code[j]))
+	{
+		word_t words[3];
+		memcpy(words, code + j, INSTR_WORDS(code[j]) * sizeof(word_t));
+		if(words[0] >> 24 == STR)
+		{
+			if((words[0] & IMMVL_MASK) + data > IMMVL_MASK)
+			{
+				fprintf(stderr, "ERROR: Data section is full\n");
+				++as->errors;
+				free(index);
+				return 0;
+			}
+			words[0] = (words[0] & ~IMMVL_MASK) | ((words[0] & IMMVL_MASK) + data);
+		}
+
+		if(as->buffered)
+		{
+			lasm_ir_t ir;
+			lasm_decode(words, &ir);
+			lasm_emit_ir(as, &ir);
+		}
+		else
+		{
+			size_t k; for(k = 0; k < INSTR_WORDS(words[0]); k++)
+				lasm_emit(as, words[k]);
+		}
+	}
+
+	for(i = 0; i < header->sym_count; i++)
+	{
+		const char* name = strings + symbols[i].name;
+		lasm_symtable_put_label(as, name, strlen(name), pc + index[symbols[i].pc]);
+	}
+
+	// labels which are not defined yet are patched once everything is linked (or kept as relocations in an object)
+	for(i = 0; i < header->reloc_count; i++)
+	{
+		const lasm_obj_reloc_t* reloc = &relocs[i];
+		const char* name = strings + reloc->name;
+		size_t length = strlen(name);
+		size_t at = pc + index[reloc->at];
+
+		if(reloc->kind == LOBJ_RELOC_VAR)
+			lasm_patch(as, at, lasm_variable_get(as, name, length), 0);
+		else
+		{
+			lasm_entry_t* entry = lasm_table_get(&as->labels, name, length);
+			lasm_patch(as, at, entry ? entry->value : 0, 1);
+			if(entry && !as->relocatable) continue;
+		}
+
+		if(as->relocatable || reloc->kind == LOBJ_RELOC_LABEL)
+			lasm_add_fixup(as, reloc->kind, at, name, length, reloc->lineno);
+	}
+
+	free(index);
+	return 1;
+}
+
+// link an object container file into the program ("-" reads from stdin), returns true if successful
+int lasm_link_file(lasm_t* as, const char* filename)
+{
+	if(!lasm_open(as, filename))
+	{
+		fprintf(stderr, "ERROR: Could not open input file (%s)\n", filename);
+		++as->errors;
+		return 0;
+	}
+
+	int ok = lasm_link(as, as->source, as->source_size);
+	if(!ok)
+		fprintf(stderr, "ERROR: Could not link object (%s)\n", filename);
+	lasm_close_files(as);
+	return ok;
+}
+
+// finish the program and get a copy of its words, which lvm_load can take ownership of (returns NULL if the program
+// could not be assembled), the data section follows the code behind a DATA word holding its length in bytes
+word_t* lasm_program(lasm_t* as, size_t* length)
+{
+	if(!lasm_finish(as)) return NULL;
+
+	size_t data_words = lasm_data_words(as);
+	size_t words = as->code_length + (data_words ? data_words + 1 : 0);
+
+	word_t* program = malloc((words ? words : 1) * sizeof(word_t));
+	if(!program) return NULL;
+
+	if(as->code_length)
+		memcpy(program, as->code, as->code_length * sizeof(word_t));
+	if(data_words)
+	{
+		program[as->code_length] = ENCODE_IVVV(DATA, as->data_length);
+		memset(program + as->code_length + 1, 0, data_words * sizeof(word_t));
+		memcpy(program + as->code_length + 1, as->data, as->data_length);
+	}
+	*length = words;
+	return program;
+}
+
+// finish the program and write it into a file, in the object container when assembling an object, in the binary
+// container if the name ends in LVMB_EXTENSION and as text otherwise (returns true if successful)
+int lasm_write(lasm_t* as, const char* out)
+{
+	if(as->relocatable)
+		return lasm_write_object(as, out);
+	if(!lasm_finish(as)) return 0;
+
+	if(lasm_has_extension(out, LVMB_EXTENSION))
+		return lasm_write_binary(as, out);
+	return lasm_write_text(as, out);
+}
+
+// assemble a single source held in memory into a program which lvm_load can take ownership of (returns NULL if the
+// source could not be assembled)
+word_t* lasm_compile(const char* source, size_t length, int optimize, size_t* words)
+{
+	lasm_t* as = lasm_create();
+	if(!as) return NULL;
+
+	lasm_setopt(as, optimize);
+
+	word_t* program = lasm_assemble(as, source, length) ? lasm_program(as, words) : NULL;
+	lasm_destroy(as);
+	return program;
+}
+
+#ifndef LASM_NO_MAIN
+int main(int argc, char* argv[])
+{
+	// lasm [-O] [-s] out.lvm files... (a file named - is read from stdin, files ending in .lobj are linked as objects
+	// and an output ending in .lobj makes an object)
+	int optimize = 0;
+	int strip = 0;
+	int first = 1;
+	while(first < argc && (!strcmp(argv[first], "-O") || !strcmp(argv[first], "-s")))
+	{
+		if(argv[first][1] == 'O')
+			optimize = 1;
+		else
+			strip = 1;
+		++first;
+	}
+
+	if(argc - first >= 2)
+	{
+		const char* out = argv[first];
+
+		lasm_t* as = lasm_create();
+		if(!as)
+		{
+			fprintf(stderr, "ERROR: Out of memory\n");
+			return 1;
+		}
+		lasm_setreloc(as, lasm_has_extension(out, LOBJ_EXTENSION));
+		lasm_setopt(as, optimize);
+		lasm_setstrip(as, strip);
+
+		// every file is read once, labels used before they are defined are patched at the end
+		int i; for(i = first + 1; i < argc; i++)
+		{
+			if(lasm_has_extension(argv[i], LOBJ_EXTENSION))
+				lasm_link_file(as, argv[i]);
+			else
+				lasm_assemble_file(as, argv[i]);
+		}
+
+		if(!lasm_finish(as))
+		{
+			lasm_destroy(as);
+			return 1;
+		}
+
+		if(!lasm_write(as, out))
+		{
+			fprintf(stderr, "ERROR: Could not write output file (%s)\n", out);
+			lasm_destroy(as);
+			return 1;
+		}
+
+		lasm_symtable_debug(as);
+
+		lasm_destroy(as);
+		return 0;
+	}
+	fprintf(stderr, "invalid arguments to cmd line!\n");
+	return 1;
+}
+#endif
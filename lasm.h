@@ -0,0 +1,199 @@
+#ifndef LASM_H_
+#define LASM_H_
+
+#include "lvm.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* amount of slots in the perfect hash tables of the mnemonics and registers (powers of two) */
+#define MNEM_SLOTS		0x100
+#define REG_SLOTS		0x40
+
+/* relocatable object container ("LOBJ" when read as bytes, stored in host byte order) */
+#define LOBJ_MAGIC		0x4A424F4C
+#define LOBJ_VERSION	2
+
+/* extension used to select the relocatable object container in lasm */
+#define LOBJ_EXTENSION	".lobj"
+
+/* relocation kinds */
+#define LOBJ_RELOC_LABEL	0		// the immediate is the location of a label
+#define LOBJ_RELOC_VAR		1		// the immediate is the index of a variable
+
+/* the operand types */
+typedef enum
+{
+	OPTYPE_IRVVV,
+	OPTYPE_IRR00,
+	OPTYPE_IRRR0,
+	OPTYPE_IRRRR,
+	OPTYPE_IVVVV,
+	OPTYPE_IR000,
+	OPTYPE_IRRV,
+} lasm_operand_type;
+
+// object container header (every section offset is in bytes from the start of the file and 4 byte aligned)
+typedef struct lasm_obj_header
+{
+	uint32_t magic;			// LOBJ_MAGIC
+	uint32_t version;		// LOBJ_VERSION
+	uint32_t code_offset;	// offset of the code section (array of word_t)
+	uint32_t code_length;	// length of the code section in words
+	uint32_t data_offset;	// offset of the data section (string literals, the immediates of str are offsets into it)
+	uint32_t data_length;	// length of the data section in bytes
+	uint32_t sym_offset;	// offset of the label definitions (array of lvm_bin_sym_t, in the order they were defined)
+	uint32_t sym_count;		// amount of label definitions
+	uint32_t reloc_offset;	// offset of the relocations (array of lasm_obj_reloc_t)
+	uint32_t reloc_count;	// amount of relocations
+	uint32_t str_offset;	// offset of the name strings
+	uint32_t str_length;	// length of the name strings in bytes
+} lasm_obj_header_t;
+
+// object container relocation (the immediate of the word is replaced once the program the object is linked into is
+// known)
+typedef struct lasm_obj_reloc
+{
+	uint32_t at;			// location of the word in the code section
+	uint32_t kind;			// LOBJ_RELOC_LABEL or LOBJ_RELOC_VAR
+	uint32_t name;			// offset of the null terminated name in the strings
+	uint32_t lineno;		// line the name was referenced on
+} lasm_obj_reloc_t;
+
+// block of the name arena (names live until the assembler is destroyed)
+typedef struct lasm_arena_block
+{
+	struct lasm_arena_block* next;	// previously filled block
+	size_t used;					// amount of bytes in use
+	size_t capacity;				// size of data in bytes
+	char data[];					// null terminated names
+} lasm_arena_block_t;
+
+// name table entry
+typedef struct lasm_entry
+{
+	const char* name;			// interned name (NULL if the slot is empty)
+	size_t length;				// length of the name
+	uint32_t hash;				// hash of the name
+	size_t value;				// value the name maps to
+} lasm_entry_t;
+
+// name table (open addressing with linear probing, names are interned in the arena)
+typedef struct lasm_table
+{
+	lasm_entry_t* entries;		// slots
+	size_t capacity;			// amount of slots (a power of two)
+	size_t length;				// amount of names in the table
+} lasm_table_t;
+
+// token type enum
+typedef enum
+{
+	TOKEN_LABEL,
+	TOKEN_INTEGER,
+	TOKEN_REGISTER,
+	TOKEN_INSTR,
+	TOKEN_STRING,
+} lasm_tokentype;
+
+// the token value struct
+typedef struct lasm_token
+{
+	lasm_tokentype type;		// the type of the token
+	const char* text;			// text of the token (points into the source, or into the scratch buffer for strings with escapes)
+	size_t length;				// length of the text
+	intptr_t integer;			// if the token was an integer, this holds the integer value of the token
+	int label;					// whether the integer is the location of a label
+	int variable;				// whether the integer is the index of a variable
+	int resolved;				// whether the label was defined when the token was read (if not, the integer is a placeholder)
+} lasm_token_t;
+
+// the symbol table struct
+typedef struct lasm_symtable
+{
+	size_t capacity;			// the current capacity of the labels array and the pcs array
+	size_t length;				// the current length of the labels array and the pcs array
+	const char** labels;		// the labels array (names are interned in the arena)
+	size_t* pcs;				// the program counter array
+} lasm_symtable_t;
+
+// intermediate instruction (instructions are kept in this form until the optimizer is done with them)
+typedef struct lasm_ir
+{
+	uint8_t opcode;				// instruction opcode
+	lasm_operand_type optype;	// operand layout of the opcode
+	uint8_t regs[4];			// register arguments
+	intptr_t integer;			// immediate value
+	int label;					// whether the immediate is a location in the program (and has to move with the code)
+	int dead;					// whether the optimizer removed the instruction
+} lasm_ir_t;
+
+// reference to a label which was not defined yet when it was read (or, when assembling an object, any reference to a
+// label or variable)
+typedef struct lasm_fixup
+{
+	int kind;					// LOBJ_RELOC_LABEL or LOBJ_RELOC_VAR
+	size_t at;					// location of the instruction to patch
+	const char* name;			// name of the label or variable (interned in the arena)
+	int lineno;					// line the label was referenced on
+} lasm_fixup_t;
+
+// assembler context (every source assembled with the same context becomes part of one program)
+typedef struct lasm
+{
+	lasm_symtable_t symbols;			// used for storing labels in the order they were defined
+	lasm_table_t labels;				// used for querying labels (the first definition of a name wins)
+	lasm_table_t variables;				// variable indices by name
+	lasm_table_t literals;				// offsets of the string literals in the data section by text
+	lasm_arena_block_t* arena;			// storage of every interned name
+	uint32_t mnem_seed;					// seed of the perfect hash of the mnemonics
+	uint32_t reg_seed;					// seed of the perfect hash of the registers
+	int8_t mnem_slots[MNEM_SLOTS];		// mnemonic index by perfect hash (-1 if none)
+	int8_t reg_slots[REG_SLOTS];		// register index by perfect hash (-1 if none)
+	lasm_token_t token;					// last token read
+	FILE* input_file;					// input file (NULL when assembling from memory)
+	char* source;						// contents of the input file (mapped or read into memory)
+	size_t source_size;					// size of the contents in bytes
+	int mapped;							// whether the contents are mapped (or were read into memory)
+	const char* cur;					// position of the lexer in the source
+	const char* end;					// end of the source
+	char* scratch;						// buffer for strings with escape sequences
+	size_t scratch_capacity;			// capacity of the scratch buffer
+	int lineno;							// line number
+	int errors;							// amount of errors reported so far
+	int finished;						// whether the program was finished (see lasm_finish)
+	word_t* code;						// assembled words
+	size_t code_length;					// amount of assembled words
+	size_t code_capacity;				// capacity of the code array
+	uint8_t* data;						// data section (string literals, each followed by a null terminator)
+	size_t data_length;					// length of the data section in bytes
+	size_t data_capacity;				// capacity of the data array
+	int optimize;						// whether to optimize the program before encoding it (-O)
+	int strip;							// whether routines which are never reached are left out (-s)
+	int relocatable;					// whether an object is assembled (references are kept as relocations)
+	int buffered;						// whether instructions are kept as ir until the program is finished (unless an object is assembled)
+	lasm_ir_t* ir;						// intermediate instructions (locations in them are instruction indices)
+	size_t ir_length;					// amount of intermediate instructions
+	size_t ir_capacity;					// capacity of the ir array
+	lasm_fixup_t* fixups;				// references to labels defined later on (relocations in an object)
+	size_t fixup_length;				// amount of fixups
+	size_t fixup_capacity;				// capacity of the fixups array
+} lasm_t;
+
+word_t *lasm_compile(const char *source,size_t length,int optimize,size_t *words);
+int lasm_write(lasm_t *as,const char *out);
+int lasm_write_object(lasm_t *as,const char *out);
+word_t *lasm_program(lasm_t *as,size_t *length);
+int lasm_finish(lasm_t *as);
+int lasm_link_file(lasm_t *as,const char *filename);
+int lasm_link(lasm_t *as,const void *object,size_t size);
+int lasm_assemble_file(lasm_t *as,const char *filename);
+int lasm_assemble(lasm_t *as,const char *source,size_t length);
+void lasm_setreloc(lasm_t *as,int value);
+void lasm_setstrip(lasm_t *as,int value);
+void lasm_setopt(lasm_t *as,int value);
+void lasm_destroy(lasm_t *as);
+lasm_t *lasm_create(void);
+
+#endif
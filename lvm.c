@@ -2,11 +2,58 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
 
-// push a value onto the virtual machine's stack
-void lvm_stack_push(lvm_stack_t* stack, intptr_t value)
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+// initialize a virtual stack (nothing is allocated until the first push)
+void lvm_stack_init(lvm_stack_t* stack, size_t initial, size_t max_depth)
+{
+	stack->values = NULL;
+	stack->position = 0;
+	stack->capacity = 0;
+	stack->initial = initial;
+	stack->max_depth = max_depth;
+}
+
+// free the values of a virtual stack
+void lvm_stack_free(lvm_stack_t* stack)
+{
+	free(stack->values);
+	lvm_stack_init(stack, stack->initial, stack->max_depth);
+}
+
+// private: grow a virtual stack (returns false if it is already as deep as it may get)
+static int lvm_stack_grow(lvm_stack_t* stack)
+{
+	if(stack->capacity >= stack->max_depth) return 0;
+
+	size_t capacity = stack->capacity ? stack->capacity * 2 : stack->initial;
+	if(capacity > stack->max_depth) capacity = stack->max_depth;
+
+	intptr_t* values = realloc(stack->values, capacity * sizeof(intptr_t));
+	if(!values) return 0;
+
+	stack->values = values;
+	stack->capacity = capacity;
+	return 1;
+}
+
+// push a value onto the virtual machine's stack (returns false if the stack is full)
+int lvm_stack_push(lvm_stack_t* stack, intptr_t value)
 {
+	if(stack->position >= stack->capacity && !lvm_stack_grow(stack))
+		return 0;
+
 	stack->values[stack->position++] = value;
+	return 1;
 }
 
 // pop a value from the virtual machine's stack
@@ -14,29 +61,259 @@ intptr_t lvm_stack_pop(lvm_stack_t* stack)
 {
 	if(stack->position > 0)
 		return stack->values[--stack->position];
-	else
+	else if(stack->values)
 		return stack->values[stack->position];
+	return 0;
+}
+
+// initialize an output buffer writing to a file (nothing is allocated until the first write)
+void lvm_output_init(lvm_output_t* output, size_t initial, FILE* file)
+{
+	output->data = NULL;
+	output->length = 0;
+	output->capacity = 0;
+	output->initial = initial;
+	output->file = file;
+}
+
+// free an output buffer, writing what is still buffered first
+void lvm_output_free(lvm_output_t* output)
+{
+	lvm_output_flush(output);
+	free(output->data);
+	lvm_output_init(output, output->initial, output->file);
+}
+
+// write everything buffered to the output's file (returns true if successful)
+int lvm_output_flush(lvm_output_t* output)
+{
+	if(!output->length) return 1;
+
+	size_t written = fwrite(output->data, 1, output->length, output->file);
+	int ok = written == output->length && fflush(output->file) == 0;
+	output->length = 0;
+	return ok;
+}
+
+// write bytes through an output buffer, writes which do not fit into an empty buffer go to the file directly
+// (returns true if successful)
+int lvm_output_write(lvm_output_t* output, const void* bytes, size_t length)
+{
+	if(!length) return 1;
+
+	if(length > output->capacity - output->length)
+	{
+		if(!output->data && output->initial)
+		{
+			output->data = malloc(output->initial);
+			output->capacity = output->data ? output->initial : 0;
+		}
+
+		if(length > output->capacity - output->length && !lvm_output_flush(output)) return 0;
+		if(length > output->capacity)
+			return fwrite(bytes, 1, length, output->file) == length;
+	}
+
+	memcpy(output->data + output->length, bytes, length);
+	output->length += length;
+	return 1;
+}
+
+// write a character through an output buffer (returns true if successful)
+int lvm_output_putc(lvm_output_t* output, char c)
+{
+	if(output->length < output->capacity)
+	{
+		output->data[output->length++] = c;
+		return 1;
+	}
+	return lvm_output_write(output, &c, 1);
+}
+
+// write an integer in decimal through an output buffer, as prt does (returns true if successful)
+int lvm_output_int(lvm_output_t* output, intptr_t value)
+{
+	char text[0x10];
+	int length = snprintf(text, sizeof(text), "%d", (int)value);
+	return lvm_output_write(output, text, length);
+}
+
+// initialize an input buffer reading from a file (nothing is allocated until the first read)
+void lvm_input_init(lvm_input_t* input, size_t initial, FILE* file, int owns_file)
+{
+	input->data = NULL;
+	input->position = 0;
+	input->length = 0;
+	input->capacity = 0;
+	input->initial = initial;
+	input->file = file;
+	input->owns_file = owns_file;
+	input->eof = 0;
+}
+
+// free an input buffer, closing its file if it was opened for it (the input goes back to stdin)
+void lvm_input_free(lvm_input_t* input)
+{
+	free(input->data);
+	if(input->owns_file)
+		fclose(input->file);
+	lvm_input_init(input, input->initial, stdin, 0);
+}
+
+// private: read up to length bytes from the input's file, returning as soon as any are available (returns the amount
+// read, 0 once the end of the file is reached)
+static size_t lvm_input_raw(lvm_input_t* input, void* bytes, size_t length)
+{
+	if(input->eof) return 0;
+
+#ifdef _WIN32
+	size_t amt = fread(bytes, 1, length, input->file);
+#else
+	// reads interrupted by a signal are retried
+	ssize_t amt;
+	do amt = read(fileno(input->file), bytes, length);
+	while(amt < 0 && errno == EINTR);
+	if(amt < 0) amt = 0;
+#endif
+
+	if(amt == 0)
+		input->eof = 1;
+	return amt;
+}
+
+// private: read more of the file into the read ahead buffer, moving the bytes which were not consumed yet to its start
+// and doubling it if they fill it (returns false once nothing more can be read)
+static int lvm_input_fill(lvm_input_t* input)
+{
+	if(input->position > 0)
+	{
+		memmove(input->data, input->data + input->position, input->length - input->position);
+		input->length -= input->position;
+		input->position = 0;
+	}
+
+	if(input->length == input->capacity)
+	{
+		size_t capacity = input->capacity ? input->capacity * 2 : input->initial;
+		char* data = realloc(input->data, capacity);
+		if(!data) return 0;
+
+		input->data = data;
+		input->capacity = capacity;
+	}
+
+	size_t amt = lvm_input_raw(input, input->data + input->length, input->capacity - input->length);
+	input->length += amt;
+	return amt > 0;
+}
+
+// read length bytes from an input into memory, reads of at least a buffer's worth skip the read ahead buffer (returns
+// the amount of bytes read, which is less than length only at the end of the input)
+size_t lvm_input_read(lvm_input_t* input, void* bytes, size_t length)
+{
+	size_t done = 0;
+
+	while(done < length)
+	{
+		size_t buffered = input->length - input->position;
+
+		if(buffered)
+		{
+			size_t amt = buffered < length - done ? buffered : length - done;
+			memcpy((char*)bytes + done, input->data + input->position, amt);
+			input->position += amt;
+			done += amt;
+		}
+		else if(length - done >= input->initial)
+		{
+			size_t amt = lvm_input_raw(input, (char*)bytes + done, length - done);
+			if(!amt) break;
+			done += amt;
+		}
+		else if(!lvm_input_fill(input))
+			break;
+	}
+
+	return done;
 }
 
-// initialize the vm's c interface module
-void lvm_cint_init(lvm_cint_t* interface)
+// get the next record of an input, which ends at the delimiter (or at the end of the input), storing its length without
+// the delimiter (returns NULL once the input is exhausted), the record points into the read ahead buffer and stays
+// valid until the input is read again
+const char* lvm_input_record(lvm_input_t* input, char delimiter, size_t* length)
 {
-	unsigned int i;
-	for(i = 0; i < MAX_BIND_AMT; i++)
+	size_t scanned = 0;
+
+	for(;;)
 	{
-		interface->occupied[i] = 0;
-		interface->bound_functions[i] = NULL;
+		size_t buffered = input->length - input->position;
+		const char* start = input->data + input->position;
+		const char* end = buffered > scanned ? memchr(start + scanned, delimiter, buffered - scanned) : NULL;
+
+		if(end)
+		{
+			*length = end - start;
+			input->position += *length + 1;
+			return start;
+		}
+
+		// records longer than the buffer make it grow
+		scanned = buffered;
+		if(!lvm_input_fill(input)) break;
 	}
+
+	*length = input->length - input->position;
+	if(!*length) return NULL;
+
+	const char* start = input->data + input->position;
+	input->position = input->length;
+	return start;
+}
+
+// create a c interface module with nothing bound (returns NULL if unsuccessful)
+lvm_cint_t* lvm_cint_create(void)
+{
+	lvm_cint_t* interface = malloc(sizeof(lvm_cint_t));
+	if(!interface) return NULL;
+
+	interface->bound_functions = NULL;
+	interface->capacity = 0;
+	return interface;
+}
+
+// destroy a c interface module
+void lvm_cint_destroy(lvm_cint_t* interface)
+{
+	if(!interface) return;
+
+	free(interface->bound_functions);
+	free(interface);
 }
 
 // bind a function to the vm (returns true if successful)
 int lvm_cint_bind(lvm_cint_t* interface, lvm_cint_fn fn, size_t id)
 {
-	if(id >= MAX_BIND_AMT) return 0;
-	if(interface->occupied[id]) return 0;
+	if(id >= MAX_BIND_AMT || !fn) return 0;
+	if(id < interface->capacity && interface->bound_functions[id]) return 0;
+
+	// the table only grows to cover the highest bound id
+	if(id >= interface->capacity)
+	{
+		size_t capacity = interface->capacity ? interface->capacity * 2 : 0x10;
+		while(capacity <= id) capacity *= 2;
+		if(capacity > MAX_BIND_AMT) capacity = MAX_BIND_AMT;
+
+		lvm_cint_fn* bound_functions = realloc(interface->bound_functions, capacity * sizeof(lvm_cint_fn));
+		if(!bound_functions) return 0;
+
+		size_t i; for(i = interface->capacity; i < capacity; i++)
+			bound_functions[i] = NULL;
+
+		interface->bound_functions = bound_functions;
+		interface->capacity = capacity;
+	}
 
 	interface->bound_functions[id] = fn;
-	interface->occupied[id] = 1;
 
 	return 1;
 }
@@ -44,8 +321,8 @@ int lvm_cint_bind(lvm_cint_t* interface, lvm_cint_fn fn, size_t id)
 // overwrite a previously bound function, if no previous function was bound, no overwrite occurs (returns true if successful)
 int lvm_cint_overbind(lvm_cint_t* interface, lvm_cint_fn fn, size_t id)
 {
-	if(id >= MAX_BIND_AMT) return 0;
-	if(!interface->occupied[id]) return 0;
+	if(id >= interface->capacity || !fn) return 0;
+	if(!interface->bound_functions[id]) return 0;
 
 	interface->bound_functions[id] = fn;
 
@@ -55,9 +332,7 @@ int lvm_cint_overbind(lvm_cint_t* interface, lvm_cint_fn fn, size_t id)
 // call a bound function (does nothing if function doesn't exist)
 void lvm_cint_call(lvm_cint_t* interface, lvm_t* vm, size_t id)
 {
-	if(id >= MAX_BIND_AMT) return;
-	if(!interface->occupied[id]) return;
-
+	if(!interface || id >= interface->capacity) return;
 	if(!interface->bound_functions[id]) return;
 
 	interface->bound_functions[id](vm);
@@ -67,7 +342,6 @@ void lvm_cint_call(lvm_cint_t* interface, lvm_t* vm, size_t id)
 void lvm_prg_ldr_init(lvm_prg_ldr_t* ldr)
 {
 	ldr->input_file = NULL;
-	ldr->last_char = ' ';
 }
 
 // load a file into the vm program loader (returns true if successful)
@@ -80,131 +354,595 @@ int lvm_prg_ldr_loadf(lvm_prg_ldr_t* ldr, const char* filename)
 	return 1;
 }	
 
-// read a program from the loaded file (returns NULL if unsuccessful)
-word_t* lvm_prg_ldr_read(lvm_prg_ldr_t* ldr)
+// close the file loaded into the vm program loader
+void lvm_prg_ldr_close(lvm_prg_ldr_t* ldr)
+{
+	if(ldr->input_file)
+	{
+		fclose(ldr->input_file);
+		ldr->input_file = NULL;
+	}
+}
+
+// private: get the value of a hexadecimal digit (returns -1 if the character is not one)
+static int lvm_prg_ldr_hexval(int c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// read a program in the hex text format from the loaded file, storing its length in words (returns NULL if unsuccessful)
+word_t* lvm_prg_ldr_read(lvm_prg_ldr_t* ldr, size_t* length)
 {
 	if(!ldr->input_file)
 		return NULL;
 
-	word_t* program = NULL;
+	// read the whole file in large blocks
+	size_t text_capacity = 0x10000;
+	size_t text_length = 0;
+	char* text = malloc(text_capacity);
+	if(!text) return NULL;
 
-	ldr->last_char = ' ';
+	size_t amt;
+	while((amt = fread(text + text_length, 1, text_capacity - text_length, ldr->input_file)) > 0)
+	{
+		text_length += amt;
+		if(text_length == text_capacity)
+		{
+			text_capacity *= 2;
+			char* grown = realloc(text, text_capacity);
+			if(!grown)
+			{
+				free(text);
+				return NULL;
+			}
+			text = grown;
+		}
+	}
 
-	size_t program_capacity = 2;
+	// every word takes at least INSTR_CHAR_LENGTH + 1 characters, except possibly the last one
+	size_t program_capacity = text_length / (INSTR_CHAR_LENGTH + 1) + 1;
 	size_t program_length = 0;
+	word_t* program = malloc(sizeof(word_t) * program_capacity);
+	if(!program)
+	{
+		free(text);
+		return NULL;
+	}
 
-	while(ldr->last_char != EOF)
+	size_t i = 0;
+	while(i < text_length)
 	{
-		program = realloc(program, sizeof(word_t) * program_capacity);
-		while(isspace(ldr->last_char))
-			ldr->last_char = fgetc(ldr->input_file);
+		// anything which isn't a hex digit separates words
+		while(i < text_length && lvm_prg_ldr_hexval(text[i]) < 0)
+			++i;
 
+		word_t word = 0;
 		int pos = 0;
-		while(isxdigit(ldr->last_char))
+		int digit;
+		while(i < text_length && (digit = lvm_prg_ldr_hexval(text[i])) >= 0)
 		{
-			ldr->read_buf[pos] = ldr->last_char;
+			word = (word << 4) | digit;
 			++pos;
-			ldr->read_buf[pos] = '\0';	
-			ldr->last_char = fgetc(ldr->input_file);
+			++i;
 		}
 
 		if(pos == INSTR_CHAR_LENGTH)
-		{
-			program[program_length] = (word_t)strtol(ldr->read_buf, NULL, 16);
-			++program_length;
-			if(program_length >= program_capacity)
-				program_capacity *= 2;
-		}
+			program[program_length++] = word;
 	}
 
+	free(text);
+
+	*length = program_length;
 	return program;
 }
 
-// initialize a jump table
-void lvm_jmp_init(lvm_jmp_t* jmp)
+// check whether the loaded file is a binary container (returns true if it is)
+int lvm_prg_ldr_is_binary(lvm_prg_ldr_t* ldr)
+{
+	if(!ldr->input_file) return 0;
+
+	uint32_t magic = 0;
+	size_t amt = fread(&magic, sizeof(magic), 1, ldr->input_file);
+	rewind(ldr->input_file);
+
+	return amt == 1 && magic == LVMB_MAGIC;
+}
+
+// private: check that a section lies within a container of the given size
+static int lvm_bin_section_valid(size_t size, uint32_t offset, size_t length)
+{
+	return (offset % sizeof(uint32_t)) == 0 && offset <= size && length <= size - offset;
+}
+
+// map the binary container in the loaded file into memory without copying it (returns true if successful)
+int lvm_prg_ldr_map(lvm_prg_ldr_t* ldr, lvm_bin_t* bin)
 {
-	jmp->current_jmp_lvl = 0;
+	if(!ldr->input_file) return 0;
+
+	lvm_bin_init(bin);
+
+#ifdef _WIN32
+	if(fseek(ldr->input_file, 0, SEEK_END) != 0) return 0;
+	long size = ftell(ldr->input_file);
+	rewind(ldr->input_file);
+	if(size <= 0) return 0;
+
+	bin->base = malloc(size);
+	if(!bin->base) return 0;
+	bin->size = size;
+
+	if(fread(bin->base, 1, bin->size, ldr->input_file) != bin->size)
+	{
+		lvm_bin_unmap(bin);
+		return 0;
+	}
+#else
+	struct stat info;
+	int fd = fileno(ldr->input_file);
+	if(fstat(fd, &info) != 0 || info.st_size <= 0) return 0;
+
+	void* base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(base == MAP_FAILED) return 0;
+
+	bin->base = base;
+	bin->size = info.st_size;
+#endif
+
+	const lvm_bin_header_t* header = bin->base;
+
+	if(bin->size < sizeof(lvm_bin_header_t) || header->magic != LVMB_MAGIC)
+	{
+		lvm_bin_unmap(bin);
+		return 0;
+	}
+
+	if(header->version != LVMB_VERSION)
+	{
+		fprintf(stderr, "ERROR: Unsupported binary container version %u (expected %u)\n", header->version, LVMB_VERSION);
+		lvm_bin_unmap(bin);
+		return 0;
+	}
+
+	if(!lvm_bin_section_valid(bin->size, header->code_offset, (size_t)header->code_length * sizeof(word_t)) ||
+		!lvm_bin_section_valid(bin->size, header->data_offset, header->data_length) ||
+		!lvm_bin_section_valid(bin->size, header->sym_offset, (size_t)header->sym_count * sizeof(lvm_bin_sym_t)) ||
+		!lvm_bin_section_valid(bin->size, header->str_offset, header->str_length) ||
+		(header->str_length > 0 && ((const char*)bin->base)[header->str_offset + header->str_length - 1] != '\0'))
+	{
+		fprintf(stderr, "ERROR: Malformed binary container\n");
+		lvm_bin_unmap(bin);
+		return 0;
+	}
+
+	bin->header = header;
+	bin->code = (const word_t*)((const char*)bin->base + header->code_offset);
+	bin->data = (const uint8_t*)bin->base + header->data_offset;
+	bin->symbols = (const lvm_bin_sym_t*)((const char*)bin->base + header->sym_offset);
+	bin->strings = (const char*)bin->base + header->str_offset;
+
+	return 1;
+}
+
+// initialize a binary container so that nothing is mapped
+void lvm_bin_init(lvm_bin_t* bin)
+{
+	bin->base = NULL;
+	bin->size = 0;
+	bin->header = NULL;
+	bin->code = NULL;
+	bin->data = NULL;
+	bin->symbols = NULL;
+	bin->strings = NULL;
+}
+
+// unmap a binary container (if one is mapped)
+void lvm_bin_unmap(lvm_bin_t* bin)
+{
+	if(!bin->base) return;
+
+#ifdef _WIN32
+	free(bin->base);
+#else
+	munmap(bin->base, bin->size);
+#endif
+
+	lvm_bin_init(bin);
+}
+
+// get the name of a symbol in a binary container (returns NULL if it has none)
+const char* lvm_bin_symbol_name(const lvm_bin_t* bin, size_t index)
+{
+	if(!bin->header || index >= bin->header->sym_count) return NULL;
+	if(bin->symbols[index].name >= bin->header->str_length) return NULL;
+
+	return bin->strings + bin->symbols[index].name;
+}
+
+// initialize a return address stack (nothing is allocated until the first call)
+void lvm_calls_init(lvm_calls_t* calls, size_t initial, size_t max_depth)
+{
+	calls->return_pcs = NULL;
+	calls->depth = 0;
+	calls->capacity = 0;
+	calls->initial = initial;
+	calls->max_depth = max_depth;
+}
+
+// free the locations of a return address stack
+void lvm_calls_free(lvm_calls_t* calls)
+{
+	free(calls->return_pcs);
+	lvm_calls_init(calls, calls->initial, calls->max_depth);
+}
+
+// push the location to return to onto the return address stack (returns false if the stack is full)
+int lvm_calls_push(lvm_calls_t* calls, size_t pc)
+{
+	if(calls->depth >= calls->capacity)
+	{
+		if(calls->capacity >= calls->max_depth) return 0;
+
+		size_t capacity = calls->capacity ? calls->capacity * 2 : calls->initial;
+		if(capacity > calls->max_depth) capacity = calls->max_depth;
+
+		size_t* return_pcs = realloc(calls->return_pcs, capacity * sizeof(size_t));
+		if(!return_pcs) return 0;
+
+		calls->return_pcs = return_pcs;
+		calls->capacity = capacity;
+	}
+
+	calls->return_pcs[calls->depth++] = pc;
+	return 1;
+}
+
+// pop the location to return to from the return address stack (returns fallback if the stack is empty)
+size_t lvm_calls_pop(lvm_calls_t* calls, size_t fallback)
+{
+	if(calls->depth == 0) return fallback;
+
+	return calls->return_pcs[--calls->depth];
+}
+
+// get the instruction a fused instruction starts with (the fused instruction's record is laid out like it, so
+// running that instruction and then the records after it has the same effect as the fused instruction)
+int lvm_unfused(int op)
+{
+	switch(op)
+	{
+	case CMPJNE: case CMPJE: case CMPJGT: case CMPJLT: case CMPJGE: case CMPJLE:
+		return CMP;
+	case ADDI:
+		return MOV;
+	case CALLV:
+		return PUSH;
+	}
+	return op;
+}
+
+// get the amount of records a fused instruction executes (1 for every other instruction)
+int lvm_fused_length(int op)
+{
+	switch(op)
+	{
+	case CMPJNE: case CMPJE: case CMPJGT: case CMPJLT: case CMPJGE: case CMPJLE: case ADDI:
+		return 2;
+	case CALLV:
+		return 4;
+	}
+	return 1;
 }
 
-// jump to an instruction and store the return location on the jump table
-void lvm_jmp_jump(lvm_jmp_t* jmp, size_t current_pc, size_t new_pc)
+// private: get the fused compare-and-branch instruction for a conditional branch (returns NOP if there is none)
+static int lvm_fuse_cmpj(int op)
 {
-	if(jmp->current_jmp_lvl > 0)
+	switch(op)
 	{
-		if(jmp->jmpfrom_locations[jmp->current_jmp_lvl - 1] == current_pc)	// if the location from which we are jumping is the location
-			return;															// which was jumped from previously we do not need to add to the table
+	case JNE: return CMPJNE;
+	case JE: return CMPJE;
+	case JGT: return CMPJGT;
+	case JLT: return CMPJLT;
+	case JGE: return CMPJGE;
+	case JLE: return CMPJLE;
 	}
+	return NOP;
+}
+
+// replace common instruction sequences in pre-decoded code with fused instructions, only the first record of a
+// sequence is rewritten so that branches into the middle of it still run the original instructions
+void lvm_fuse(lvm_instr_t* code, size_t length)
+{
+	size_t i; for(i = 0; i < length; i++)
+	{
+		lvm_instr_t* instr = &code[i];
+		const lvm_instr_t* next = &code[i + 1];
 
-	jmp->jmpfrom_locations[jmp->current_jmp_lvl] = current_pc;
-	jmp->jmpto_locations[jmp->current_jmp_lvl] = new_pc;
-	++jmp->current_jmp_lvl;
+		// cmp %a %b, j?? @label
+		if(instr->op == CMP && i + 1 < length && lvm_fuse_cmpj(next->op) != NOP)
+		{
+			instr->op = lvm_fuse_cmpj(next->op);
+			instr->immd = next->immd;
+		}
+		// mov %m imm, add %d %a %b where %m is %a or %b
+		else if(instr->op == MOV && i + 1 < length && next->op == ADD &&
+			(next->reg2 == instr->reg1 || next->reg3 == instr->reg1))
+		{
+			instr->op = ADDI;
+			instr->reg2 = next->reg1;
+			instr->reg3 = next->reg2;
+			instr->reg4 = next->reg3;
+		}
+		// push %x, get %x #fn, call %x %a %b %c, pop %x
+		else if(instr->op == PUSH && i + 3 < length && instr->reg1 != ZERO_REG && instr->reg1 != ESL_REG &&
+			next[0].op == GET && next[0].reg1 == instr->reg1 &&
+			next[1].op == CALL && next[1].reg1 == instr->reg1 &&
+			next[2].op == POP && next[2].reg1 == instr->reg1)
+		{
+			instr->op = CALLV;
+			instr->reg2 = next[1].reg2;
+			instr->reg3 = next[1].reg3;
+			instr->reg4 = next[1].reg4;
+			instr->immd = next[0].immd;
+		}
+	}
 }
 
-// get the pc from which we jumped to the location passed in as the pc
-size_t lvm_jmp_back(lvm_jmp_t* jmp, size_t pc)
+// translate a program into pre-decoded instructions, resolving immediates per opcode and storing the
+// amount of variables the program uses (returns NULL if unsuccessful)
+lvm_instr_t* lvm_predecode(const word_t* program, size_t length, size_t* variables)
 {
-	size_t i; for(i = 0; i <= jmp->current_jmp_lvl; i++)
+	lvm_instr_t* code = malloc(sizeof(lvm_instr_t) * (length + 1));
+	if(!code) return NULL;
+
+	*variables = 0;
+
+	size_t i; for(i = 0; i < length; i++)
 	{
-		if(jmp->jmpto_locations[i] == pc)
+		word_t word = program[i];
+		lvm_instr_t* instr = &code[i];
+
+		instr->op = (word & INSTR_MASK) >> 24;
+		instr->reg1 = (word & REG1_MASK) >> 20;
+		instr->reg2 = (word & REG2_MASK) >> 16;
+		instr->reg3 = (word & REG3_MASK) >> 12;
+		instr->reg4 = (word & REG4_MASK) >> 8;
+
+		switch(instr->op)
+		{
+		case JMP: case JNE: case JE: case JGT: case JLT: case JGE: case JLE: case RET: case JSR: case PUSHI:
+			instr->immd = (word & LIMMVL_MASK);
+			break;
+		case LD8: case LD16: case LD32: case LD64: case ST8: case ST16: case ST32: case ST64:
+			instr->immd = (int16_t)(word & OFFSET_MASK);
+			break;
+		case MOVW: case MOVQ:
+			instr->immd = lvm_wide_immediate(program, length, i);
+			break;
+		case LONG:
+			// a long branch becomes the branch it holds
+			instr->op = word & BRANCH_MASK;
+			instr->immd = lvm_wide_immediate(program, length, i);
+			break;
+		default:
+			instr->immd = (word & IMMVL_MASK);
+			break;
+		}
+
+		// branches outside of the program land on the trailing halt
+		switch(instr->op)
+		{
+		case SET: case GET: case GETA:
+			if((size_t)instr->immd >= *variables)
+				*variables = instr->immd + 1;
+			break;
+		case JMP: case JNZ: case JZ: case JNE: case JE: case JGT: case JLT: case JGE: case JLE: case JSR:
+			if((size_t)instr->immd > length)
+				instr->immd = length;
+			break;
+		}
+
+		// the zero and stack length registers are reset before every instruction, so
+		// writes to them only matter for their side effects and go to the sink instead
+		if(instr->reg1 == ZERO_REG || instr->reg1 == ESL_REG)
+		{
+			switch(instr->op)
+			{
+			case MOV: case ADD: case SUB: case MUL: case DIV: case MOVR:
+			case POP: case GET: case GETA: case DREF: case STR:
+			case LD8: case LD16: case LD32: case LD64: case MOVW: case MOVQ:
+				instr->reg1 = SINK_REG;
+				break;
+			case NEG: case ASL: case ASR: case MASK:
+				if(instr->reg1 == ESL_REG)
+					instr->op = NOP;
+				break;
+			}
+		}
+
+		// the immediate words of a wide instruction are only ever reached by a long branch which was not taken
+		size_t words = INSTR_WORDS(word);
+		while(--words && i + 1 < length)
 		{
-			jmp->current_jmp_lvl = i;
-			return jmp->jmpfrom_locations[i];
+			lvm_instr_t* ext = &code[++i];
+			ext->op = NOP;
+			ext->reg1 = ext->reg2 = ext->reg3 = ext->reg4 = 0;
+			ext->immd = 0;
 		}
 	}
 
-	return -1;	// the pc passed in was never jumped to
+	code[length].op = HALT;
+	code[length].reg1 = ZERO_REG;
+	code[length].reg2 = code[length].reg3 = code[length].reg4 = 0;
+	code[length].immd = 0;
+
+	lvm_fuse(code, length);
+	return code;
 }
 
-// initialize a vm 
-void lvm_init(lvm_t* vm)
+// initialize a vm using the given creation parameters (config may be NULL), nothing is allocated until it is needed
+void lvm_init_config(lvm_t* vm, const lvm_config_t* config)
 {
 	vm->pc = 0;
+	vm->cmp1 = 0;
+	vm->cmp2 = 0;
+	memset(vm->regs, 0, sizeof(vm->regs));
 	vm->instr_num = 0;
 	vm->reg1 = 0;
 	vm->reg2 = 0;
 	vm->reg3 = 0;
+	vm->reg4 = 0;
 	vm->immd = 0;
 	vm->limd = 0;
+	vm->image = NULL;
 	vm->program = NULL;
+	vm->length = 0;
+	vm->code = NULL;
+	vm->data = NULL;
 	vm->current = 0;
 	vm->running = 0;
-	vm->should_free = 0;
+	vm->result = 0;
 	vm->debug = 0;
-	lvm_prg_ldr_init(&vm->loader);
-	lvm_jmp_init(&vm->jmp_table);
-	lvm_cint_init(&vm->cint);
-	vm->stack.position = 0;
+	vm->use_jit = config ? config->jit : 0;
+	vm->jit = NULL;
+	vm->profile = 0;
+	vm->prof = NULL;
+	vm->sample = 0;
+	vm->sampler = NULL;
+	lvm_calls_init(&vm->calls, (config && config->call_capacity) ? config->call_capacity : INITIAL_CALL_CAPACITY,
+		(config && config->max_call_depth) ? config->max_call_depth : MAX_CALL_DEPTH);
+	lvm_stack_init(&vm->stack, (config && config->stack_capacity) ? config->stack_capacity : INITIAL_STACK_CAPACITY,
+		(config && config->max_stack_depth) ? config->max_stack_depth : MAX_STACK_DEPTH);
+	vm->cint = config ? config->cint : NULL;
+	vm->owns_cint = 0;
+	vm->db.values = NULL;
+	vm->db.length = 0;
+	lvm_output_init(&vm->output, (config && config->output_capacity) ? config->output_capacity : OUTPUT_BUFFER_SIZE,
+		stdout);
+	lvm_input_init(&vm->input, (config && config->input_capacity) ? config->input_capacity : INPUT_BUFFER_SIZE,
+		stdin, 0);
+}
+
+// initialize a vm with the default creation parameters
+void lvm_init(lvm_t* vm)
+{
+	lvm_init_config(vm, NULL);
+}
+
+// create a vm on the heap using the given creation parameters (returns NULL if unsuccessful)
+lvm_t* lvm_create(const lvm_config_t* config)
+{
+	lvm_t* vm = malloc(sizeof(lvm_t));
+	if(!vm) return NULL;
+
+	lvm_init_config(vm, config);
+	return vm;
+}
+
+// destroy a vm created with lvm_create
+void lvm_destroy(lvm_t* vm)
+{
+	if(!vm) return;
+
+	lvm_close(vm);
+	free(vm);
 }
 
-// fetch and store the current instruction within the vm's loaded program
+// fetch and store the current instruction within the vm's loaded program (running past the end fetches a halt)
 void lvm_fetch(lvm_t* vm)
 {
 	if(vm->program != NULL)
-		vm->current = vm->program[vm->pc++];
+	{
+		if(vm->pc < vm->length)
+			vm->current = vm->program[vm->pc++];
+		else
+			vm->current = ENCODE_IR00(HALT, ZERO_REG);
+	}
+}
+
+// decode an instruction word into the vm's decoded fields
+void lvm_decode_word(lvm_t* vm, word_t word)
+{
+	vm->instr_num = (word & INSTR_MASK) >> 24;
+	vm->reg1 = (word & REG1_MASK) >> 20;
+	vm->reg2 = (word & REG2_MASK) >> 16;
+	vm->reg3 = (word & REG3_MASK) >> 12;
+	vm->reg4 = (word & REG4_MASK) >> 8;
+	vm->immd = (word & IMMVL_MASK);
+	vm->limd = (word & LIMMVL_MASK);
 }
 
-// decode the currently loaded instruction within the vm
+// get the immediate of the wide instruction at pc from the words after it (words past the end of the program read as
+// zero)
+intptr_t lvm_wide_immediate(const word_t* program, size_t length, size_t pc)
+{
+	uint64_t low = pc + 1 < length ? program[pc + 1] : 0;
+	uint64_t high = pc + 2 < length ? program[pc + 2] : 0;
+
+	switch(program[pc] >> 24)
+	{
+	case MOVW: return (int32_t)low;
+	case MOVQ: return (intptr_t)(low | high << 32);
+	}
+	return (intptr_t)low;
+}
+
+// decode the currently loaded instruction within the vm (a wide instruction is decoded as the mov or branch it holds
+// and the program counter moves past its immediate words)
 void lvm_decode(lvm_t* vm)
 {
-	vm->instr_num = (vm->current & INSTR_MASK) >> 24;
-	vm->reg1 = (vm->current & REG1_MASK) >> 20;
-	vm->reg2 = (vm->current & REG2_MASK) >> 16;
-	vm->reg3 = (vm->current & REG3_MASK) >> 12;
-	vm->reg4 = (vm->current & REG4_MASK) >> 8;
-	vm->immd = (vm->current & IMMVL_MASK);
-	vm->limd = (vm->current & LIMMVL_MASK);
+	lvm_decode_word(vm, vm->current);
+
+	int words = INSTR_WORDS(vm->current);
+	if(words == 1 || !vm->program) return;
+
+	size_t pc = vm->pc - 1;
+	vm->immd = vm->limd = lvm_wide_immediate(vm->program, vm->length, pc);
+	vm->instr_num = vm->instr_num == LONG ? (int)(vm->current & BRANCH_MASK) : MOV;
+	vm->pc = pc + words < vm->length ? pc + words : vm->length;
 }
 
-// evaluate the currently decoded instruction within the vm
-void lvm_eval(lvm_t* vm)
+// load the value an ld instruction reads from an address (zero extended, the address does not have to be aligned)
+intptr_t lvm_ld(int op, const void* address)
 {
-	vm->regs[ZERO_REG] = 0;
-	vm->regs[ESL_REG] = vm->stack.position;
-	switch(vm->instr_num)
+	switch(op)
 	{
-	case HALT:
-		vm->running = 0;
-		vm->result = vm->regs[vm->reg1];
+	case LD8: { uint8_t value; memcpy(&value, address, sizeof(value)); return value; }
+	case LD16: { uint16_t value; memcpy(&value, address, sizeof(value)); return value; }
+	case LD32: { uint32_t value; memcpy(&value, address, sizeof(value)); return value; }
+	}
+
+	uint64_t value;
+	memcpy(&value, address, sizeof(value));
+	return (intptr_t)value;
+}
+
+// store the low bytes of a value at an address as an st instruction does (the address does not have to be aligned)
+void lvm_st(int op, void* address, intptr_t value)
+{
+	switch(op)
+	{
+	case ST8: { uint8_t low = value; memcpy(address, &low, sizeof(low)); return; }
+	case ST16: { uint16_t low = value; memcpy(address, &low, sizeof(low)); return; }
+	case ST32: { uint32_t low = value; memcpy(address, &low, sizeof(low)); return; }
+	}
+
+	uint64_t low = value;
+	memcpy(address, &low, sizeof(low));
+}
+
+// evaluate the currently decoded instruction within the vm
+void lvm_eval(lvm_t* vm)
+{
+	vm->regs[ZERO_REG] = 0;
+	vm->regs[ESL_REG] = vm->stack.position;
+	switch(vm->instr_num)
+	{
+	case HALT:
+		vm->running = 0;
+		vm->result = vm->regs[vm->reg1];
 		break;
 	case MOV:
 		if(vm->debug)
@@ -239,17 +977,16 @@ void lvm_eval(lvm_t* vm)
 	case PRT:
 		if(vm->debug)
 			printf("prt\n");
-		printf("%d", vm->regs[vm->reg1]);
+		lvm_output_int(&vm->output, vm->regs[vm->reg1]);
 		break;
 	case PRTC:
 		if(vm->debug)
 			printf("prtc\n");
-		printf("%c", ((char)vm->regs[vm->reg1]));
+		lvm_output_putc(&vm->output, (char)vm->regs[vm->reg1]);
 		break;
 	case JMP:
 		if(vm->debug)
 			printf("jmp\n");
-		lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 		vm->pc = vm->limd;
 		break;
 	case JNZ:
@@ -257,7 +994,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jnz\n");
 		if(vm->regs[vm->reg1] != 0)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->immd);
 			vm->pc = vm->immd;
 		}
 		break;
@@ -266,7 +1002,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jz\n");
 		if(vm->regs[vm->reg1] == 0)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->immd);
 			vm->pc = vm->immd;
 		}
 		break;
@@ -275,7 +1010,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jne\n");
 		if(vm->cmp1 != vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -284,7 +1018,6 @@ void lvm_eval(lvm_t* vm)
 			printf("je\n");
 		if(vm->cmp1 == vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -293,7 +1026,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jgt\n");
 		if(vm->cmp1 > vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -302,7 +1034,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jlt\n");
 		if(vm->cmp1 < vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -311,7 +1042,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jge\n");
 		if(vm->cmp1 >= vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -320,7 +1050,6 @@ void lvm_eval(lvm_t* vm)
 			printf("jle\n");
 		if(vm->cmp1 <= vm->cmp2)
 		{
-			lvm_jmp_jump(&vm->jmp_table, vm->pc, vm->limd);
 			vm->pc = vm->limd;
 		}
 		break;
@@ -332,8 +1061,20 @@ void lvm_eval(lvm_t* vm)
 		break;
 	case RET:
 		if(vm->debug)
-			printf("jbo\n");
-		vm->pc = lvm_jmp_back(&vm->jmp_table, vm->limd);
+			printf("ret\n");
+		vm->pc = lvm_calls_pop(&vm->calls, vm->length);
+		break;
+	case JSR:
+		if(vm->debug)
+			printf("jsr\n");
+		if(!lvm_calls_push(&vm->calls, vm->pc))
+		{
+			fprintf(stderr, "ERROR: Call stack overflow at pc %u\n", (unsigned int)(vm->pc - 1));
+			vm->running = 0;
+			vm->result = 1;
+			break;
+		}
+		vm->pc = vm->limd;
 		break;
 	case MOVR:
 		if(vm->debug)
@@ -343,7 +1084,7 @@ void lvm_eval(lvm_t* vm)
 	case CALL:
 		if(vm->debug)
 			printf("call\n");
-		lvm_cint_call(&vm->cint, vm, vm->regs[vm->reg1]);
+		lvm_cint_call(vm->cint, vm, vm->regs[vm->reg1]);
 		break;
 	case PUSH:
 		if(vm->debug)
@@ -398,37 +1139,152 @@ void lvm_eval(lvm_t* vm)
 	case PUSHI:
 		if(vm->debug)
 			printf("pushi\n");
-		lvm_push(vm, vm->immd);
+		lvm_push(vm, vm->limd);
 		break;	
+	case STR:
+		if(vm->debug)
+			printf("str\n");
+		vm->regs[vm->reg1] = (intptr_t)(vm->data + vm->immd);
+		break;
+	case WRT:
+		if(vm->debug)
+			printf("wrt\n");
+		lvm_output_write(&vm->output, (const void*)vm->regs[vm->reg1], (size_t)vm->regs[vm->reg2]);
+		break;
+	case LD8: case LD16: case LD32: case LD64:
+		if(vm->debug)
+			printf("%s\n", lvm_opname(vm->instr_num));
+		vm->regs[vm->reg1] = lvm_ld(vm->instr_num, (char*)vm->regs[vm->reg2] + (int16_t)(vm->immd & OFFSET_MASK));
+		break;
+	case ST8: case ST16: case ST32: case ST64:
+		if(vm->debug)
+			printf("%s\n", lvm_opname(vm->instr_num));
+		lvm_st(vm->instr_num, (char*)vm->regs[vm->reg2] + (int16_t)(vm->immd & OFFSET_MASK), vm->regs[vm->reg1]);
+		break;
 	}
 
+	// the output is kept in order with the debug messages
 	if(vm->debug)
+	{
+		lvm_output_flush(&vm->output);
 		printf("instr performed at pc %u\n", vm->pc);
+	}
 }
 
-// binds a c function to the lvm (warning supplied if unsuccessful)
+// binds a c function to the lvm, creating its binding table on first use (warning supplied if unsuccessful)
 void lvm_bind(lvm_t* vm, lvm_cint_fn fn, size_t id)
 {
-	if(!lvm_cint_bind(&vm->cint, fn, id))
+	if(!vm->cint)
+	{
+		vm->cint = lvm_cint_create();
+		vm->owns_cint = 1;
+	}
+
+	if(!vm->cint || !lvm_cint_bind(vm->cint, fn, id))
 		fprintf(stderr, "WARNING: Attempt to bind function to id [%u] failed!\n", id);
 }
 
 // overwrites a previously bound function in the lvm (warning supplied if unsuccessful)
 void lvm_overbind(lvm_t* vm, lvm_cint_fn fn, size_t id)
 {
-	if(!lvm_cint_overbind(&vm->cint, fn, id))
+	if(!vm->cint || !lvm_cint_overbind(vm->cint, fn, id))
 		fprintf(stderr, "WARNING: Attempt to bind over a function bound at id [%u] failed!\n", id);
 }
 
-// resets a vm so that no program is loaded (if a program is loaded)
+// resets a vm so that no program is loaded (bindings and stack storage are kept for the next program)
 void lvm_reset(lvm_t* vm)
 {
-	if(vm->program)
-	{
-		if(vm->should_free)
-			free(vm->program);
-		lvm_init(vm);
-	}
+	lvm_image_release(vm->image);
+	vm->image = NULL;
+
+	free(vm->db.values);
+	vm->db.values = NULL;
+	vm->db.length = 0;
+
+#ifdef LVM_JIT
+	lvm_jit_destroy(vm->jit);
+#endif
+	vm->jit = NULL;
+
+	lvm_prof_destroy(vm->prof);
+	vm->prof = NULL;
+	lvm_sample_destroy(vm->sampler);
+	vm->sampler = NULL;
+
+	vm->program = NULL;
+	vm->length = 0;
+	vm->code = NULL;
+	vm->data = NULL;
+	vm->pc = 0;
+	vm->running = 0;
+	vm->stack.position = 0;
+	vm->calls.depth = 0;
+}
+
+// rewinds a vm so that its loaded program can run again from the start with clean registers, stacks and variables
+void lvm_rewind(lvm_t* vm)
+{
+	if(vm->running) return;
+
+	vm->pc = 0;
+	vm->cmp1 = 0;
+	vm->cmp2 = 0;
+	memset(vm->regs, 0, sizeof(vm->regs));
+	vm->stack.position = 0;
+	vm->calls.depth = 0;
+	if(vm->db.values)
+		memset(vm->db.values, 0, vm->db.length * sizeof(intptr_t));
+}
+
+// set whether the vm compiles hot code to native code (has no effect in builds without the jit, or while debugging)
+void lvm_setjit(lvm_t* vm, int value)
+{
+	vm->use_jit = value;
+}
+
+// set whether the vm profiles the programs it runs (see lvm_prof_report)
+void lvm_setprof(lvm_t* vm, int value)
+{
+	vm->profile = value;
+}
+
+// set the rate of the sampling profiler in samples per second of cpu time (0 turns it off, has no effect in builds
+// without it, see lvm_sample_report)
+void lvm_setsample(lvm_t* vm, unsigned int rate)
+{
+	vm->sample = rate;
+}
+
+// set the file the vm's output goes to (NULL for stdout), anything buffered for the previous one is written first
+void lvm_setoutput(lvm_t* vm, FILE* file)
+{
+	lvm_output_flush(&vm->output);
+	vm->output.file = file ? file : stdout;
+}
+
+// set the file the vm's input comes from (NULL for stdin), anything read ahead from the previous one is dropped
+void lvm_setinput(lvm_t* vm, FILE* file)
+{
+	lvm_input_free(&vm->input);
+	vm->input.file = file ? file : stdin;
+}
+
+// open a file for the vm's input to come from, it is closed once other input is set or the vm is closed (returns true
+// if successful)
+int lvm_openinput(lvm_t* vm, const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if(!file) return 0;
+
+	lvm_input_free(&vm->input);
+	lvm_input_init(&vm->input, vm->input.initial, file, 1);
+	return 1;
+}
+
+// write the output the vm buffered so far (returns true if successful)
+int lvm_flush(lvm_t* vm)
+{
+	return lvm_output_flush(&vm->output);
 }
 
 // set the debug flag in the vm
@@ -437,142 +1293,2529 @@ void lvm_setdbg(lvm_t* vm, int value)
 	vm->debug = value;
 }
 
-// load a program into the vm
-void lvm_load(lvm_t* vm, word_t* program, int should_free)
+// private: whether a long branch may hold an opcode
+static int lvm_is_long_branch(int op)
 {
-	if(vm->running) return;
-	lvm_reset(vm);
-	vm->program = program;
-	vm->should_free = should_free;
+	switch(op)
+	{
+	case JMP: case JNZ: case JZ: case JNE: case JE: case JGT: case JLT: case JGE: case JLE: case JSR:
+		return 1;
+	}
+	return 0;
 }
 
-// read a program from a file into the vm
-int lvm_read(lvm_t* vm, const char* filename)
+// private: create an image from length words of code and a data section of data_length bytes, taking ownership of the
+// words if should_free is set (returns NULL if unsuccessful)
+static lvm_image_t* lvm_image_build(word_t* program, size_t length, const uint8_t* data, size_t data_length,
+	int should_free)
+{
+	lvm_image_t* image = malloc(sizeof(lvm_image_t));
+	lvm_instr_t* code = image ? lvm_predecode(program, length, &image->variables) : NULL;
+
+	// the immediate words of every wide instruction have to be part of the code and long branches have to hold a branch
+	size_t i; for(i = 0; code && i < length; i += INSTR_WORDS(program[i]))
+	{
+		if(i + INSTR_WORDS(program[i]) > length)
+			fprintf(stderr, "ERROR: Wide instruction at pc %u is cut off by the end of the code\n", (unsigned int)i);
+		else if(program[i] >> 24 == LONG && !lvm_is_long_branch(program[i] & BRANCH_MASK))
+			fprintf(stderr, "ERROR: Long branch at pc %u does not hold a branch\n", (unsigned int)i);
+		else
+			continue;
+
+		free(code);
+		code = NULL;
+	}
+
+	// every literal has to lie within the data section
+	for(i = 0; code && i < length; i++)
+	{
+		if(code[i].op == STR && (size_t)code[i].immd >= data_length)
+		{
+			fprintf(stderr, "ERROR: String literal at pc %u lies outside of the data section\n", (unsigned int)i);
+			free(code);
+			code = NULL;
+		}
+	}
+
+	if(!code)
+	{
+		free(image);
+		if(should_free)
+			free(program);
+		return NULL;
+	}
+
+	image->program = program;
+	image->length = length;
+	image->code = code;
+	image->data = data_length ? data : NULL;
+	image->data_length = data_length;
+	image->should_free = should_free;
+	lvm_bin_init(&image->bin);
+	image->refs = 1;
+	return image;
+}
+
+// create an image from a program of length words, taking ownership of the words if should_free is set (returns NULL if unsuccessful)
+lvm_image_t* lvm_image_create(word_t* program, size_t length, int should_free)
+{
+	// the data section is stored after the code, behind a DATA word holding its length (the immediate words of wide
+	// instructions are skipped, as they may hold anything)
+	size_t i; for(i = 0; i < length; i += INSTR_WORDS(program[i]))
+	{
+		if((program[i] & INSTR_MASK) >> 24 != DATA) continue;
+
+		size_t data_length = program[i] & LIMMVL_MASK;
+		if(data_length > (length - i - 1) * sizeof(word_t))
+		{
+			fprintf(stderr, "ERROR: Data section is longer than the program\n");
+			if(should_free)
+				free(program);
+			return NULL;
+		}
+		return lvm_image_build(program, i, (const uint8_t*)(program + i + 1), data_length, should_free);
+	}
+
+	return lvm_image_build(program, length, NULL, 0, should_free);
+}
+
+// read an image from a file, either a binary container or hex text (returns NULL if unsuccessful)
+lvm_image_t* lvm_image_read(const char* filename)
+{
+	lvm_prg_ldr_t loader;
+	lvm_prg_ldr_init(&loader);
+	if(!lvm_prg_ldr_loadf(&loader, filename)) return NULL;
+
+	lvm_image_t* image = NULL;
+
+	if(lvm_prg_ldr_is_binary(&loader))
+	{
+		// the code section is executed straight out of the mapping
+		lvm_bin_t bin;
+		if(lvm_prg_ldr_map(&loader, &bin))
+		{
+			image = lvm_image_build((word_t*)bin.code, bin.header->code_length, bin.data, bin.header->data_length, 0);
+			if(image)
+				image->bin = bin;
+			else
+				lvm_bin_unmap(&bin);
+		}
+	}
+	else
+	{
+		size_t length = 0;
+		word_t* program = lvm_prg_ldr_read(&loader, &length);
+		if(program)
+			image = lvm_image_create(program, length, 1);
+	}
+
+	lvm_prg_ldr_close(&loader);
+	return image;
+}
+
+// take another reference to an image
+lvm_image_t* lvm_image_retain(lvm_image_t* image)
+{
+#ifdef __GNUC__
+	__atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+#else
+	++image->refs;
+#endif
+	return image;
+}
+
+// drop a reference to an image, freeing it once no references remain
+void lvm_image_release(lvm_image_t* image)
+{
+	if(!image) return;
+
+#ifdef __GNUC__
+	if(__atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+#else
+	if(--image->refs != 0) return;
+#endif
+
+	if(image->should_free)
+		free(image->program);
+	free(image->code);
+	lvm_bin_unmap(&image->bin);
+	free(image);
+}
+
+// make an image the vm's loaded program, the vm takes its own reference and gets a fresh database (returns true if successful)
+int lvm_attach(lvm_t* vm, lvm_image_t* image)
 {
 	if(vm->running) return 0;
-	if(!lvm_prg_ldr_loadf(&vm->loader, filename)) return 0;
-	word_t* program = lvm_prg_ldr_read(&vm->loader);
-	if(!program) return 0;
+
+	intptr_t* values = calloc(image->variables ? image->variables : 1, sizeof(intptr_t));
+	if(!values) return 0;
+
+	lvm_image_retain(image);
 	lvm_reset(vm);
-	vm->program = program;
-	vm->should_free = 1;
+	vm->image = image;
+	vm->program = image->program;
+	vm->length = image->length;
+	vm->code = image->code;
+	vm->data = image->data;
+	vm->db.values = values;
+	vm->db.length = image->variables;
 	return 1;
 }
 
-// run the currently loaded program on the vm
-int lvm_run(lvm_t* vm)
+// load a program (of length words) into the vm
+void lvm_load(lvm_t* vm, word_t* program, size_t length, int should_free)
 {
 	if(vm->running) return;
-	vm->running = 1;
 
-	while(vm->running)
+	lvm_image_t* image = lvm_image_create(program, length, should_free);
+	if(!image) return;
+
+	lvm_attach(vm, image);
+	lvm_image_release(image);
+}
+
+// read a program from a file (either a binary container or hex text) into the vm
+int lvm_read(lvm_t* vm, const char* filename)
+{
+	if(vm->running) return 0;
+
+	lvm_image_t* image = lvm_image_read(filename);
+	if(!image) return 0;
+
+	int attached = lvm_attach(vm, image);
+	lvm_image_release(image);
+	return attached;
+}
+
+#ifdef LVM_JIT
+
+/* x86-64 register numbers used by the compiled blocks (rdi holds the vm, rdx the database, rax and rcx are scratch) */
+#define JIT_RAX	0
+#define JIT_RCX	1
+#define JIT_RDX	2
+#define JIT_RDI	7
+
+/* compiler slots for the comparison values (guest registers use their own index) */
+#define JIT_CMP1	(NUM_REGS + 1)
+#define JIT_CMP2	(NUM_REGS + 2)
+#define JIT_SLOTS	(NUM_REGS + 3)
+
+/* worst case amount of bytes emitted for a single instruction, a block exit and the prologue/epilogue */
+#define JIT_INSTR_BYTES	0x20
+#define JIT_EXIT_BYTES	0x10
+#define JIT_FRAME_BYTES	0x100
+
+// host registers guest registers are kept in while a block runs (the first six are callee saved)
+static const uint8_t lvm_jit_pool[] = { 3, 5, 12, 13, 14, 15, 6, 8, 9, 10, 11 };
+
+// code buffer a block is emitted into before it is copied to executable memory
+typedef struct lvm_jit_buf
+{
+	uint8_t* data;			// emitted code
+	size_t length;			// amount of bytes emitted (may exceed capacity, in which case the block is dropped)
+	size_t capacity;		// size of data in bytes
+} lvm_jit_buf_t;
+
+// branch emitted in a block whose displacement is patched once the block is complete
+typedef struct lvm_jit_fixup
+{
+	size_t at;				// offset of the 32 bit displacement in the block
+	size_t target;			// location in the program the branch goes to
+} lvm_jit_fixup_t;
+
+// create the jit compiler state for a program (returns NULL if unsuccessful)
+lvm_jit_t* lvm_jit_create(const lvm_instr_t* code, size_t length)
+{
+	lvm_jit_t* jit = malloc(sizeof(lvm_jit_t));
+	if(!jit) return NULL;
+
+	jit->code = code;
+	jit->length = length;
+	jit->counts = calloc(length + 1, sizeof(uint32_t));
+	jit->blocks = calloc(length + 1, sizeof(lvm_jit_fn));
+	jit->memory = NULL;
+	jit->used = 0;
+	jit->capacity = JIT_MEMORY_SIZE;
+
+	if(!jit->counts || !jit->blocks)
 	{
-		lvm_fetch(vm);
-		lvm_decode(vm);
-		lvm_eval(vm);
+		lvm_jit_destroy(jit);
+		return NULL;
 	}
 
-	vm->pc = 0;
+	return jit;
+}
 
-	return vm->result;
+// destroy the jit compiler state, freeing every compiled block
+void lvm_jit_destroy(lvm_jit_t* jit)
+{
+	if(!jit) return;
+
+	if(jit->memory)
+		munmap(jit->memory, JIT_MEMORY_SIZE);
+	free(jit->counts);
+	free(jit->blocks);
+	free(jit);
 }
 
-// push a value onto the stack of the vm
-void lvm_push(lvm_t* vm, intptr_t value)
+// private: emit a byte
+static void lvm_jit_byte(lvm_jit_buf_t* buf, uint8_t value)
 {
-	lvm_stack_push(&vm->stack, value);
+	if(buf->length < buf->capacity)
+		buf->data[buf->length] = value;
+	buf->length++;
 }
 
-// pop a value from the stack of the vm
-intptr_t lvm_pop(lvm_t* vm)
+// private: emit a 32 bit value
+static void lvm_jit_u32(lvm_jit_buf_t* buf, uint32_t value)
 {
-	return lvm_stack_pop(&vm->stack);
+	unsigned int i; for(i = 0; i < 4; i++)
+		lvm_jit_byte(buf, (value >> (i * 8)) & 0xFF);
 }
 
-// close the vm
-void lvm_close(lvm_t* vm)
+// private: patch a previously emitted 32 bit value
+static void lvm_jit_patch(lvm_jit_buf_t* buf, size_t at, uint32_t value)
 {
-	lvm_reset(vm);
+	unsigned int i; for(i = 0; i < 4; i++)
+	{
+		if(at + i < buf->capacity)
+			buf->data[at + i] = (value >> (i * 8)) & 0xFF;
+	}
 }
 
-// bound functions 
+// private: emit a 64 bit register to register instruction (reg goes in the modrm reg field, rm in the rm field)
+static void lvm_jit_rr(lvm_jit_buf_t* buf, uint8_t opcode, int reg, int rm)
+{
+	lvm_jit_byte(buf, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+	lvm_jit_byte(buf, opcode);
+	lvm_jit_byte(buf, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
 
-void lvm_fnmalloc(lvm_t* vm)
+// private: emit a 64 bit register to memory instruction addressing [base + disp] (base may not be rsp, rbp, r12 or r13)
+static void lvm_jit_rm(lvm_jit_buf_t* buf, uint8_t opcode, int reg, int base, int32_t disp)
 {
-	vm->regs[vm->reg2] = (intptr_t)malloc((size_t)vm->regs[vm->reg3]);
+	lvm_jit_byte(buf, 0x48 | ((reg >> 3) << 2) | (base >> 3));
+	lvm_jit_byte(buf, opcode);
+	lvm_jit_byte(buf, 0x80 | ((reg & 7) << 3) | (base & 7));
+	lvm_jit_u32(buf, (uint32_t)disp);
 }
 
-void lvm_fnrealloc(lvm_t* vm)
+// private: emit a load (zero extended) or store of a width in bits between a register and [base + disp] (base may not be
+// rsp, rbp, r12 or r13)
+static void lvm_jit_mem(lvm_jit_buf_t* buf, int store, int width, int reg, int base, int32_t disp)
 {
-	vm->regs[vm->reg2] = (intptr_t)realloc((void*)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+	uint8_t rex = 0x40 | (width == 64 ? 0x08 : 0) | ((reg >> 3) << 2) | (base >> 3);
+
+	if(store && width == 16)
+		lvm_jit_byte(buf, 0x66);
+	// byte stores always take a prefix, so that the low bytes of rsi and rdi are used instead of ah and bh
+	if(rex != 0x40 || (store && width == 8))
+		lvm_jit_byte(buf, rex);
+
+	if(store)
+		lvm_jit_byte(buf, width == 8 ? 0x88 : 0x89);
+	else if(width < 32)
+	{
+		lvm_jit_byte(buf, 0x0F);
+		lvm_jit_byte(buf, width == 8 ? 0xB6 : 0xB7);
+	}
+	else
+		lvm_jit_byte(buf, 0x8B);
+
+	lvm_jit_byte(buf, 0x80 | ((reg & 7) << 3) | (base & 7));
+	lvm_jit_u32(buf, (uint32_t)disp);
 }
 
-void lvm_fnfree(lvm_t* vm)
+// private: emit a push or pop (opcode 0x50 or 0x58) of a register
+static void lvm_jit_stack(lvm_jit_buf_t* buf, uint8_t opcode, int reg)
 {
-	free((void*)vm->regs[vm->reg2]);
+	if(reg >= 8)
+		lvm_jit_byte(buf, 0x41);
+	lvm_jit_byte(buf, opcode + (reg & 7));
 }
 
-void lvm_fnset(lvm_t* vm)
+// private: emit a move of a value into a register, using the shortest encoding for it
+static void lvm_jit_mov_imm(lvm_jit_buf_t* buf, int reg, intptr_t value)
 {
-	memset((void*)vm->regs[vm->reg2], (int)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+	if(value >= 0 && (uint64_t)value <= 0xFFFFFFFF)
+	{
+		// 32 bit moves zero the upper half
+		if(reg >= 8)
+			lvm_jit_byte(buf, 0x41);
+		lvm_jit_byte(buf, 0xB8 + (reg & 7));
+		lvm_jit_u32(buf, (uint32_t)value);
+	}
+	else if(value >= INT32_MIN && value <= INT32_MAX)
+	{
+		lvm_jit_rr(buf, 0xC7, 0, reg);
+		lvm_jit_u32(buf, (uint32_t)value);
+	}
+	else
+	{
+		lvm_jit_byte(buf, 0x48 | (reg >> 3));
+		lvm_jit_byte(buf, 0xB8 + (reg & 7));
+		lvm_jit_u32(buf, (uint32_t)value);
+		lvm_jit_u32(buf, (uint32_t)((uint64_t)value >> 32));
+	}
 }
 
-void lvm_fncpy(lvm_t* vm)
+// private: emit dst = dst op src for add, sub and mul
+static void lvm_jit_binop(lvm_jit_buf_t* buf, int op, int dst, int src)
 {
-	memcpy((void*)vm->regs[vm->reg2], (void*)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+	switch(op)
+	{
+	case ADD: lvm_jit_rr(buf, 0x01, src, dst); break;
+	case SUB: lvm_jit_rr(buf, 0x29, src, dst); break;
+	case MUL:
+		lvm_jit_byte(buf, 0x48 | ((dst >> 3) << 2) | (src >> 3));
+		lvm_jit_byte(buf, 0x0F);
+		lvm_jit_byte(buf, 0xAF);
+		lvm_jit_byte(buf, 0xC0 | ((dst & 7) << 3) | (src & 7));
+		break;
+	}
 }
 
-void lvm_fntobyte(lvm_t* vm)
+// private: emit dst = a op b for add, sub and mul
+static void lvm_jit_arith(lvm_jit_buf_t* buf, int op, int dst, int a, int b)
 {
-	vm->regs[vm->reg2] = (uint8_t)(*(intptr_t*)vm->regs[vm->reg2]);
+	if(dst == b && dst != a)
+	{
+		if(op != SUB)
+		{
+			lvm_jit_binop(buf, op, dst, a);
+			return;
+		}
+
+		lvm_jit_rr(buf, 0x89, a, JIT_RAX);
+		lvm_jit_binop(buf, op, JIT_RAX, b);
+		lvm_jit_rr(buf, 0x89, JIT_RAX, dst);
+		return;
+	}
+
+	if(dst != a)
+		lvm_jit_rr(buf, 0x89, a, dst);
+	lvm_jit_binop(buf, op, dst, b);
 }
 
-void lvm_fntodbyte(lvm_t* vm)
+// private: emit a jump (cond 0 for an unconditional one) to a location in the program, recording it to be patched later
+static void lvm_jit_branch(lvm_jit_buf_t* buf, uint8_t cond, size_t target, lvm_jit_fixup_t* fixups, size_t* fixup_count)
 {
-	vm->regs[vm->reg2] = (uint16_t)(*(intptr_t*)vm->regs[vm->reg2]);
+	if(cond)
+	{
+		lvm_jit_byte(buf, 0x0F);
+		lvm_jit_byte(buf, cond);
+	}
+	else
+		lvm_jit_byte(buf, 0xE9);
+
+	fixups[*fixup_count].at = buf->length;
+	fixups[*fixup_count].target = target;
+	(*fixup_count)++;
+	lvm_jit_u32(buf, 0);
 }
 
-void lvm_fntoword(lvm_t* vm)
+// private: get the offset of the vm field a compiler slot is stored in
+static int32_t lvm_jit_slot_offset(int slot)
 {
-	vm->regs[vm->reg2] = *(uint32_t*)vm->regs[vm->reg2];
+	if(slot == JIT_CMP1) return offsetof(lvm_t, cmp1);
+	if(slot == JIT_CMP2) return offsetof(lvm_t, cmp2);
+	return offsetof(lvm_t, regs) + slot * sizeof(intptr_t);
 }
 
-void lvm_fntodword(lvm_t* vm)
+// private: get the compiler slots an instruction uses (returns -1 if the jit cannot compile it, 0 if it can be left out)
+static int lvm_jit_operands(const lvm_instr_t* instr, uint8_t* slots)
 {
-	vm->regs[vm->reg2] = *(uint64_t*)vm->regs[vm->reg2]; 
+	int op = lvm_unfused(instr->op);
+
+	switch(op)
+	{
+	case MOV: case ADD: case SUB: case MUL: case MOVR: case GET: case GETA: case DREF:
+	case LD8: case LD16: case LD32: case LD64: case MOVW: case MOVQ:
+		// writes to the sink are never read back
+		if(instr->reg1 == SINK_REG) return 0;
+		break;
+	}
+
+	switch(op)
+	{
+	case NOP: case JMP:
+		return 0;
+	case MOV: case MOVW: case MOVQ: case NEG: case JNZ: case JZ: case SET: case GET: case GETA:
+		slots[0] = instr->reg1;
+		return 1;
+	case MOVR: case ASL: case ASR: case MASK: case DREF: case SETV:
+	case LD8: case LD16: case LD32: case LD64: case ST8: case ST16: case ST32: case ST64:
+		slots[0] = instr->reg1;
+		slots[1] = instr->reg2;
+		return 2;
+	case ADD: case SUB: case MUL:
+		slots[0] = instr->reg1;
+		slots[1] = instr->reg2;
+		slots[2] = instr->reg3;
+		return 3;
+	case CMP:
+		slots[0] = instr->reg1;
+		slots[1] = instr->reg2;
+		slots[2] = JIT_CMP1;
+		slots[3] = JIT_CMP2;
+		return 4;
+	case JNE: case JE: case JGT: case JLT: case JGE: case JLE:
+		slots[0] = JIT_CMP1;
+		slots[1] = JIT_CMP2;
+		return 2;
+	}
+
+	return -1;
 }
 
-// end of bound functions
+// private: get the condition code of a jcc instruction for a branch opcode (signed comparisons of cmp1 against cmp2)
+static uint8_t lvm_jit_condition(int op)
+{
+	switch(op)
+	{
+	case JNZ: case JNE: return 0x85;
+	case JZ: case JE: return 0x84;
+	case JGT: return 0x8F;
+	case JLT: return 0x8C;
+	case JGE: return 0x8D;
+	case JLE: return 0x8E;
+	}
+	return 0;
+}
 
-int main(int argc, char* argv[])
+// compile the block starting at entry (a straight run of supported instructions, whose branches back into the block
+// stay in native code while every other branch leaves it), returns NULL if the block could not be compiled
+lvm_jit_fn lvm_jit_compile(lvm_jit_t* jit, size_t entry)
 {
-	if(argc == 2)
+	const lvm_instr_t* code = jit->code;
+	int map[JIT_SLOTS];
+	size_t mapped = 0;
+	uint8_t slots[4];
+
+	unsigned int i; for(i = 0; i < JIT_SLOTS; i++)
+		map[i] = -1;
+
+	// find the end of the block, giving every slot it uses a host register
+	size_t end = entry;
+	while(end < jit->length && end - entry < JIT_MAX_BLOCK)
 	{
-		lvm_t vm;
-		lvm_init(&vm);
-		
-		lvm_bind(&vm, &lvm_fnmalloc, 0);
-		lvm_bind(&vm, &lvm_fnfree, 1);
-		lvm_bind(&vm, &lvm_fnset, 2);
-		lvm_bind(&vm, &lvm_fncpy, 3);
-		lvm_bind(&vm, &lvm_fntobyte, 4);
-		lvm_bind(&vm, &lvm_fntodbyte, 5);
-		lvm_bind(&vm, &lvm_fntoword, 6);
-		lvm_bind(&vm, &lvm_fntodword, 7);
-		lvm_bind(&vm, &lvm_fnrealloc, 8);
+		int count = lvm_jit_operands(&code[end], slots);
+		if(count < 0) break;
+
+		size_t needed = 0;
+		for(i = 0; i < (unsigned int)count; i++)
+		{
+			if(map[slots[i]] < 0)
+				needed++;
+		}
+		if(mapped + needed > sizeof(lvm_jit_pool)) break;
 
-		if(argv[1][0] == '-')
-			lvm_setdbg(&vm, 1);
-		if(!lvm_read(&vm, (argv[1][0] == '-') ? (++argv[1]) : argv[1]))
+		for(i = 0; i < (unsigned int)count; i++)
 		{
-			fprintf(stderr, "ERROR: Could not read file\n");
-			return 1;
+			if(map[slots[i]] < 0)
+				map[slots[i]] = lvm_jit_pool[mapped++];
 		}
-		int res = lvm_run(&vm);
-		lvm_close(&vm);
-		return res;
+
+		if(code[end++].op == JMP) break;
 	}
 
-	fprintf(stderr, "ERROR: Invalid command line arguments (lvm program.path.here)\n");
-	return 1;
-}
\ No newline at end of file
+	if(end == entry) return NULL;
+
+	size_t length = end - entry;
+	size_t capacity = JIT_FRAME_BYTES + length * (JIT_INSTR_BYTES + JIT_EXIT_BYTES);
+	lvm_jit_buf_t buf;
+	buf.data = malloc(capacity);
+	buf.length = 0;
+	buf.capacity = capacity;
+	size_t* offsets = malloc(length * sizeof(size_t));
+	lvm_jit_fixup_t* fixups = malloc((length + 1) * sizeof(lvm_jit_fixup_t));
+	size_t fixup_count = 0;
+	lvm_jit_fn block = NULL;
+
+	if(!buf.data || !offsets || !fixups) goto done;
+
+	// prologue: save the callee saved registers and load every slot the block uses
+	for(i = 0; i < 6; i++)
+		lvm_jit_stack(&buf, 0x50, lvm_jit_pool[i]);
+	lvm_jit_rm(&buf, 0x8B, JIT_RDX, JIT_RDI, offsetof(lvm_t, db.values));
+	for(i = 0; i < JIT_SLOTS; i++)
+	{
+		if(map[i] >= 0)
+			lvm_jit_rm(&buf, 0x8B, map[i], JIT_RDI, lvm_jit_slot_offset(i));
+	}
+
+	size_t pc; for(pc = entry; pc < end; pc++)
+	{
+		const lvm_instr_t* instr = &code[pc];
+		offsets[pc - entry] = buf.length;
+
+		// fused records are compiled as the instruction they start with, followed by the records after them
+		int op = lvm_unfused(instr->op);
+		if(lvm_jit_operands(instr, slots) == 0 && op != JMP) continue;
+
+		int r1 = map[instr->reg1];
+		int r2 = map[instr->reg2];
+		int r3 = map[instr->reg3];
+
+		switch(op)
+		{
+		case MOV: case MOVW: case MOVQ:
+			lvm_jit_mov_imm(&buf, r1, instr->immd);
+			break;
+		case ADD: case SUB: case MUL:
+			lvm_jit_arith(&buf, op, r1, r2, r3);
+			break;
+		case NEG:
+			lvm_jit_rr(&buf, 0xF7, 3, r1);
+			break;
+		case MOVR:
+			if(r1 != r2)
+				lvm_jit_rr(&buf, 0x89, r2, r1);
+			break;
+		case CMP:
+			lvm_jit_rr(&buf, 0x89, r1, map[JIT_CMP1]);
+			lvm_jit_rr(&buf, 0x89, r2, map[JIT_CMP2]);
+			break;
+		case ASL: case ASR:
+			lvm_jit_rr(&buf, 0x89, r2, JIT_RCX);
+			lvm_jit_rr(&buf, 0xD3, op == ASL ? 4 : 7, r1);
+			break;
+		case MASK:
+			lvm_jit_rr(&buf, 0x21, r2, r1);
+			break;
+		case GET:
+			lvm_jit_rm(&buf, 0x8B, r1, JIT_RDX, instr->immd * sizeof(intptr_t));
+			break;
+		case SET:
+			lvm_jit_rm(&buf, 0x89, r1, JIT_RDX, instr->immd * sizeof(intptr_t));
+			break;
+		case GETA:
+			lvm_jit_rm(&buf, 0x8D, r1, JIT_RDX, instr->immd * sizeof(intptr_t));
+			break;
+		case DREF:
+			lvm_jit_rr(&buf, 0x89, r2, JIT_RAX);
+			lvm_jit_rm(&buf, 0x8B, r1, JIT_RAX, 0);
+			break;
+		case SETV:
+			lvm_jit_rr(&buf, 0x89, r1, JIT_RAX);
+			lvm_jit_rm(&buf, 0x89, r2, JIT_RAX, 0);
+			break;
+		case LD8: case LD16: case LD32: case LD64:
+			lvm_jit_rr(&buf, 0x89, r2, JIT_RAX);
+			lvm_jit_mem(&buf, 0, 8 << (op - LD8), r1, JIT_RAX, instr->immd);
+			break;
+		case ST8: case ST16: case ST32: case ST64:
+			lvm_jit_rr(&buf, 0x89, r2, JIT_RAX);
+			lvm_jit_mem(&buf, 1, 8 << (op - ST8), r1, JIT_RAX, instr->immd);
+			break;
+		case JMP:
+			lvm_jit_branch(&buf, 0, instr->immd, fixups, &fixup_count);
+			break;
+		case JNZ: case JZ:
+			lvm_jit_rr(&buf, 0x85, r1, r1);
+			lvm_jit_branch(&buf, lvm_jit_condition(op), instr->immd, fixups, &fixup_count);
+			break;
+		case JNE: case JE: case JGT: case JLT: case JGE: case JLE:
+			lvm_jit_rr(&buf, 0x39, map[JIT_CMP2], map[JIT_CMP1]);
+			lvm_jit_branch(&buf, lvm_jit_condition(op), instr->immd, fixups, &fixup_count);
+			break;
+		}
+	}
+
+	// falling off the end of the block continues in the interpreter
+	if(code[end - 1].op != JMP)
+		lvm_jit_branch(&buf, 0, end, fixups, &fixup_count);
+
+	// epilogue: store every slot back into the vm and return the location in rax
+	size_t epilogue = buf.length;
+	for(i = 0; i < JIT_SLOTS; i++)
+	{
+		if(map[i] >= 0)
+			lvm_jit_rm(&buf, 0x89, map[i], JIT_RDI, lvm_jit_slot_offset(i));
+	}
+	for(i = 6; i > 0; i--)
+		lvm_jit_stack(&buf, 0x58, lvm_jit_pool[i - 1]);
+	lvm_jit_byte(&buf, 0xC3);
+
+	// branches within the block go straight to the target, the others get an exit setting the location
+	for(i = 0; i < fixup_count; i++)
+	{
+		size_t target = fixups[i].target;
+		size_t to;
+
+		if(target >= entry && target < end)
+			to = offsets[target - entry];
+		else
+		{
+			to = buf.length;
+			lvm_jit_byte(&buf, 0xB8 + JIT_RAX);
+			lvm_jit_u32(&buf, (uint32_t)target);
+			lvm_jit_byte(&buf, 0xE9);
+			lvm_jit_u32(&buf, (uint32_t)(epilogue - (buf.length + 4)));
+		}
+
+		lvm_jit_patch(&buf, fixups[i].at, (uint32_t)(to - (fixups[i].at + 4)));
+	}
+
+	if(buf.length > buf.capacity || jit->used + buf.length > jit->capacity) goto done;
+
+	if(!jit->memory)
+	{
+		void* memory = mmap(NULL, JIT_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED)
+		{
+			jit->capacity = 0;
+			goto done;
+		}
+		jit->memory = memory;
+	}
+
+	// the memory is only ever writable while a block is copied into it
+	if(mprotect(jit->memory, JIT_MEMORY_SIZE, PROT_READ | PROT_WRITE) != 0) goto done;
+	memcpy(jit->memory + jit->used, buf.data, buf.length);
+	if(mprotect(jit->memory, JIT_MEMORY_SIZE, PROT_READ | PROT_EXEC) != 0)
+	{
+		jit->capacity = 0;
+		goto done;
+	}
+
+	block = (lvm_jit_fn)(void*)(jit->memory + jit->used);
+	jit->used += (buf.length + 15) & ~(size_t)15;
+	jit->blocks[entry] = block;
+
+done:
+	free(buf.data);
+	free(offsets);
+	free(fixups);
+	return block;
+}
+
+#undef JIT_RAX
+#undef JIT_RCX
+#undef JIT_RDX
+#undef JIT_RDI
+#undef JIT_CMP1
+#undef JIT_CMP2
+#undef JIT_SLOTS
+#undef JIT_INSTR_BYTES
+#undef JIT_EXIT_BYTES
+#undef JIT_FRAME_BYTES
+
+#endif
+
+// get the name of an opcode (fused instructions are named after the instructions they were fused from)
+const char* lvm_opname(int op)
+{
+	switch(op)
+	{
+	case HALT: return "hlt";
+	case MOV: return "mov";
+	case ADD: return "add";
+	case SUB: return "sub";
+	case MUL: return "mul";
+	case DIV: return "div";
+	case NEG: return "neg";
+	case PRT: return "prt";
+	case PRTC: return "ptc";
+	case JMP: return "jmp";
+	case JNZ: return "jnz";
+	case JZ: return "jz";
+	case JNE: return "jne";
+	case JE: return "je";
+	case JGT: return "jgt";
+	case JLT: return "jlt";
+	case JGE: return "jge";
+	case JLE: return "jle";
+	case CMP: return "cmp";
+	case RET: return "ret";
+	case MOVR: return "movr";
+	case CALL: return "call";
+	case PUSH: return "push";
+	case POP: return "pop";
+	case SET: return "set";
+	case SETV: return "setv";
+	case GET: return "get";
+	case GETA: return "geta";
+	case DREF: return "dref";
+	case ASL: return "asl";
+	case ASR: return "asr";
+	case MASK: return "mask";
+	case PUSHI: return "pushi";
+	case JSR: return "jsr";
+	case STR: return "str";
+	case WRT: return "wrt";
+	case LD8: return "ld8";
+	case LD16: return "ld16";
+	case LD32: return "ld32";
+	case LD64: return "ld64";
+	case ST8: return "st8";
+	case ST16: return "st16";
+	case ST32: return "st32";
+	case ST64: return "st64";
+	case MOVW: return "movw";
+	case MOVQ: return "movq";
+	case LONG: return "long";
+	case CMPJNE: return "cmp+jne";
+	case CMPJE: return "cmp+je";
+	case CMPJGT: return "cmp+jgt";
+	case CMPJLT: return "cmp+jlt";
+	case CMPJGE: return "cmp+jge";
+	case CMPJLE: return "cmp+jle";
+	case ADDI: return "mov+add";
+	case CALLV: return "push+get+call+pop";
+	case NOP: return "nop";
+	}
+	return "?";
+}
+
+// private: get the current time in nanoseconds (only differences between times are meaningful)
+static uint64_t lvm_prof_now(void)
+{
+#ifndef _WIN32
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#else
+	return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+// create an empty profile for a program of length words (returns NULL if unsuccessful)
+lvm_prof_t* lvm_prof_create(size_t length)
+{
+	lvm_prof_t* prof = calloc(1, sizeof(lvm_prof_t));
+	if(!prof) return NULL;
+
+	prof->length = length;
+	prof->sites = calloc(length + 1, sizeof(lvm_prof_site_t));
+	if(!prof->sites)
+	{
+		free(prof);
+		return NULL;
+	}
+	return prof;
+}
+
+// destroy a profile
+void lvm_prof_destroy(lvm_prof_t* prof)
+{
+	if(!prof) return;
+
+	free(prof->sites);
+	free(prof->frames);
+	free(prof);
+}
+
+// private: stop timing the innermost routine being timed
+static void lvm_prof_leave(lvm_prof_t* prof)
+{
+	// calls which could not be timed are the innermost ones, so they return first
+	if(prof->untimed)
+	{
+		--prof->untimed;
+		return;
+	}
+	if(!prof->depth) return;
+
+	const lvm_prof_frame_t* frame = &prof->frames[--prof->depth];
+	uint64_t elapsed = lvm_prof_now() - frame->start;
+	lvm_prof_site_t* site = &prof->sites[frame->entry];
+	if(!--site->active)
+		site->total += elapsed;
+	site->self += elapsed - frame->children;
+	if(prof->depth)
+		prof->frames[prof->depth - 1].children += elapsed;
+}
+
+// count the execution of the instruction at pc, timing the routine a jsr calls (at target) until it returns
+void lvm_prof_step(lvm_prof_t* prof, size_t pc, int op, size_t target)
+{
+	++prof->ops[op];
+
+	// a fused instruction executes the records it was fused with as well
+	int k; for(k = 0; k < lvm_fused_length(op) && pc + k <= prof->length; k++)
+		++prof->sites[pc + k].count;
+
+	if(op == RET)
+	{
+		lvm_prof_leave(prof);
+		return;
+	}
+	if(op != JSR) return;
+
+	if(target > prof->length) target = prof->length;
+	if(prof->depth == prof->capacity)
+	{
+		size_t capacity = prof->capacity ? prof->capacity * 2 : PROF_INITIAL_FRAMES;
+		lvm_prof_frame_t* frames = realloc(prof->frames, capacity * sizeof(lvm_prof_frame_t));
+		if(!frames)
+		{
+			++prof->untimed;
+			++prof->sites[target].calls;
+			return;
+		}
+		prof->frames = frames;
+		prof->capacity = capacity;
+	}
+
+	lvm_prof_frame_t* frame = &prof->frames[prof->depth++];
+	frame->entry = target;
+	frame->start = lvm_prof_now();
+	frame->children = 0;
+	++prof->sites[target].calls;
+	++prof->sites[target].active;
+}
+
+// stop timing the routines which were still running when the program stopped
+void lvm_prof_finish(lvm_prof_t* prof)
+{
+	prof->untimed = 0;
+	while(prof->depth)
+		lvm_prof_leave(prof);
+}
+
+// entry of a profile report table
+typedef struct lvm_prof_entry
+{
+	uint64_t key;			// value the table is sorted by (descending)
+	size_t index;			// opcode, location or symbol the entry is about
+} lvm_prof_entry_t;
+
+// private: order report table entries by descending key (ties by ascending index)
+static int lvm_prof_entry_cmp(const void* a, const void* b)
+{
+	const lvm_prof_entry_t* x = a;
+	const lvm_prof_entry_t* y = b;
+	if(x->key != y->key) return x->key < y->key ? 1 : -1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// private: order report table entries by ascending key (ties by ascending index)
+static int lvm_prof_entry_asc(const void* a, const void* b)
+{
+	const lvm_prof_entry_t* x = a;
+	const lvm_prof_entry_t* y = b;
+	if(x->key != y->key) return x->key < y->key ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// private: get the binary container of the vm's loaded program (one without a mapping if it was not read from one)
+static const lvm_bin_t* lvm_prof_bin(const lvm_t* vm)
+{
+	static const lvm_bin_t none = { NULL, 0, NULL, NULL, NULL, NULL, NULL };
+	return vm->image && vm->image->bin.header ? &vm->image->bin : &none;
+}
+
+// private: get the symbols of a binary container ordered by location (key is the location of the symbol, index its
+// index, returns NULL if unsuccessful)
+static lvm_prof_entry_t* lvm_prof_symbols(const lvm_bin_t* bin)
+{
+	size_t count = bin->header ? bin->header->sym_count : 0;
+	lvm_prof_entry_t* order = malloc((count + 1) * sizeof(lvm_prof_entry_t));
+	if(!order) return NULL;
+
+	size_t i; for(i = 0; i < count; i++)
+	{
+		order[i].key = bin->symbols[i].pc;
+		order[i].index = i;
+	}
+	qsort(order, count, sizeof(lvm_prof_entry_t), lvm_prof_entry_asc);
+	return order;
+}
+
+// private: find the symbol a location belongs to in the symbols ordered by location (key is the location of the
+// symbol, returns count if there is none)
+static size_t lvm_prof_symbol(const lvm_prof_entry_t* order, size_t count, size_t pc)
+{
+	size_t lo = 0, hi = count;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if(order[mid].key <= pc) lo = mid + 1;
+		else hi = mid;
+	}
+
+	// the first of several labels at the same location names it
+	if(!lo) return count;
+	size_t found = lo - 1;
+	while(found && order[found - 1].key == order[found].key) --found;
+	return found;
+}
+
+// private: print a location as the label it belongs to and the offset from that label
+static void lvm_prof_location(FILE* out, const lvm_bin_t* bin, const lvm_prof_entry_t* order, size_t count, size_t pc)
+{
+	size_t symbol = lvm_prof_symbol(order, count, pc);
+	const char* name = symbol < count ? lvm_bin_symbol_name(bin, order[symbol].index) : NULL;
+	if(!name)
+		fprintf(out, "[%u]", (unsigned int)pc);
+	else if(pc == order[symbol].key)
+		fprintf(out, "%s", name);
+	else
+		fprintf(out, "%s+%u", name, (unsigned int)(pc - order[symbol].key));
+}
+
+// write the profile of the last runs of the vm's loaded program (labels are named if the program was read from a
+// binary container)
+void lvm_prof_report(lvm_t* vm, FILE* out)
+{
+	const lvm_prof_t* prof = vm->prof;
+	if(!prof)
+	{
+		fprintf(out, "WARNING: Nothing was profiled!\n");
+		return;
+	}
+
+	size_t length = prof->length;
+	const lvm_bin_t* bin = lvm_prof_bin(vm);
+	size_t count = bin->header ? bin->header->sym_count : 0;
+
+	lvm_prof_entry_t* order = lvm_prof_symbols(bin);
+	uint64_t* spent = calloc(count + 1, sizeof(uint64_t));
+	lvm_prof_entry_t* entries = malloc((length + 1 > 256 ? length + 1 : 256) * sizeof(lvm_prof_entry_t));
+	if(!order || !spent || !entries)
+	{
+		fprintf(stderr, "ERROR: Could not allocate the profile report!\n");
+		goto done;
+	}
+
+	uint64_t total = 0;
+	size_t i; for(i = 0; i < 256; i++)
+		total += prof->ops[i];
+	fprintf(out, "profile: %llu instructions in %.3f ms\n", (unsigned long long)total, prof->elapsed / 1e6);
+
+	// instructions by opcode
+	size_t n = 0;
+	for(i = 0; i < 256; i++)
+	{
+		if(!prof->ops[i]) continue;
+		entries[n].key = prof->ops[i];
+		entries[n].index = i;
+		++n;
+	}
+	qsort(entries, n, sizeof(lvm_prof_entry_t), lvm_prof_entry_cmp);
+	fprintf(out, "\n%-20s %14s %8s\n", "opcode", "count", "%");
+	for(i = 0; i < n; i++)
+		fprintf(out, "%-20s %14llu %7.2f%%\n", lvm_opname(entries[i].index), (unsigned long long)entries[i].key,
+			total ? entries[i].key * 100.0 / total : 0.0);
+
+	// routines by time spent in them
+	n = 0;
+	for(i = 0; i <= length; i++)
+	{
+		if(!prof->sites[i].calls) continue;
+		entries[n].key = prof->sites[i].total;
+		entries[n].index = i;
+		++n;
+	}
+	qsort(entries, n, sizeof(lvm_prof_entry_t), lvm_prof_entry_cmp);
+	fprintf(out, "\n%12s %12s %12s  %s\n", "calls", "total ms", "self ms", "routine");
+	for(i = 0; i < n; i++)
+	{
+		const lvm_prof_site_t* site = &prof->sites[entries[i].index];
+		fprintf(out, "%12llu %12.3f %12.3f  ", (unsigned long long)site->calls, site->total / 1e6, site->self / 1e6);
+		lvm_prof_location(out, bin, order, count, entries[i].index);
+		fputc('\n', out);
+	}
+
+	// instructions by the label they follow
+	if(count)
+	{
+		for(i = 0; i <= length; i++)
+			spent[lvm_prof_symbol(order, count, i)] += prof->sites[i].count;
+
+		n = 0;
+		for(i = 0; i <= count; i++)
+		{
+			if(!spent[i]) continue;
+			entries[n].key = spent[i];
+			entries[n].index = i;
+			++n;
+		}
+		qsort(entries, n, sizeof(lvm_prof_entry_t), lvm_prof_entry_cmp);
+		fprintf(out, "\n%14s %8s  %s\n", "count", "%", "label");
+		for(i = 0; i < n; i++)
+		{
+			const char* name = entries[i].index < count ? lvm_bin_symbol_name(bin, order[entries[i].index].index) : NULL;
+			fprintf(out, "%14llu %7.2f%%  %s\n", (unsigned long long)entries[i].key, total ? entries[i].key * 100.0 / total : 0.0,
+				name ? name : "(before the first label)");
+		}
+	}
+
+	// most executed locations
+	n = 0;
+	for(i = 0; i <= length; i++)
+	{
+		if(!prof->sites[i].count) continue;
+		entries[n].key = prof->sites[i].count;
+		entries[n].index = i;
+		++n;
+	}
+	qsort(entries, n, sizeof(lvm_prof_entry_t), lvm_prof_entry_cmp);
+	fprintf(out, "\n%8s %14s %-8s  %s\n", "pc", "count", "opcode", "location");
+	for(i = 0; i < n && i < PROF_HOT_SPOTS; i++)
+	{
+		size_t pc = entries[i].index;
+		int op = pc < length && vm->program ? (int)((vm->program[pc] & INSTR_MASK) >> 24) : HALT;
+		fprintf(out, "%8u %14llu %-8s  ", (unsigned int)pc, (unsigned long long)entries[i].key, lvm_opname(op));
+		lvm_prof_location(out, bin, order, count, pc);
+		fputc('\n', out);
+	}
+
+done:
+	free(order);
+	free(spent);
+	free(entries);
+}
+
+#ifdef LVM_SAMPLE
+
+// sampler the timer signal marks (the interval timer is per process, so one vm samples at a time)
+static lvm_sampler_t* volatile lvm_sampling = NULL;
+
+// signal disposition the sampler replaced
+static struct sigaction lvm_sample_previous;
+
+// private: mark that a sample is due (only stores to the sampler, which is safe in a signal handler)
+static void lvm_sample_signal(int sig)
+{
+	(void)sig;
+	lvm_sampler_t* sampler = lvm_sampling;
+	if(!sampler) return;
+
+	// the switch loop checks the flag, the threaded loop is sent to its sampling handler by its next dispatch
+	sampler->pending = 1;
+	if(sampler->hook)
+	{
+		int i; for(i = 0; i < 256; i++)
+			sampler->table[i] = sampler->hook;
+	}
+}
+
+// start the interval timer which marks the samples of a sampler (returns false if another sampler is running or the
+// timer could not be set up)
+int lvm_sample_start(lvm_sampler_t* sampler)
+{
+	if(lvm_sampling) return 0;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = lvm_sample_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if(sigaction(SIGPROF, &action, &lvm_sample_previous) != 0) return 0;
+
+	lvm_sampling = sampler;
+
+	struct itimerval timer;
+	long interval = 1000000L / sampler->rate;
+	timer.it_interval.tv_sec = interval / 1000000L;
+	timer.it_interval.tv_usec = interval ? interval % 1000000L : 1;
+	timer.it_value = timer.it_interval;
+	if(setitimer(ITIMER_PROF, &timer, NULL) != 0)
+	{
+		lvm_sampling = NULL;
+		sigaction(SIGPROF, &lvm_sample_previous, NULL);
+		return 0;
+	}
+	return 1;
+}
+
+// stop the interval timer of a running sampler
+void lvm_sample_stop(lvm_sampler_t* sampler)
+{
+	if(lvm_sampling != sampler) return;
+
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	sigaction(SIGPROF, &lvm_sample_previous, NULL);
+	lvm_sampling = NULL;
+	sampler->pending = 0;
+}
+
+#endif
+
+// create an empty sampling profile for a program with the symbols of bin (bin may be NULL) at rate samples per second
+// of cpu time (0 for SAMPLE_RATE, returns NULL if unsuccessful)
+lvm_sampler_t* lvm_sample_create(const lvm_bin_t* bin, unsigned int rate)
+{
+	lvm_sampler_t* sampler = calloc(1, sizeof(lvm_sampler_t));
+	if(!sampler) return NULL;
+
+	sampler->rate = rate ? rate : SAMPLE_RATE;
+	sampler->capacity = SAMPLE_INITIAL_STACKS;
+	sampler->stacks = calloc(sampler->capacity, sizeof(lvm_sample_stack_t));
+	sampler->frame_capacity = SAMPLE_MAX_DEPTH * 4;
+	sampler->frames = malloc(sampler->frame_capacity * sizeof(size_t));
+
+	// only the locations of the labels are needed while sampling, their names are looked up in the report
+	size_t count = bin && bin->header ? bin->header->sym_count : 0;
+	lvm_prof_entry_t* order = bin ? lvm_prof_symbols(bin) : NULL;
+	sampler->labels = malloc((count + 1) * sizeof(size_t));
+	if(!sampler->stacks || !sampler->frames || !sampler->labels || (bin && !order))
+	{
+		free(order);
+		lvm_sample_destroy(sampler);
+		return NULL;
+	}
+
+	size_t i; for(i = 0; i < count; i++)
+	{
+		if(sampler->label_count && sampler->labels[sampler->label_count - 1] == order[i].key) continue;
+		sampler->labels[sampler->label_count++] = order[i].key;
+	}
+	free(order);
+	return sampler;
+}
+
+// destroy a sampling profile
+void lvm_sample_destroy(lvm_sampler_t* sampler)
+{
+	if(!sampler) return;
+
+#ifdef LVM_SAMPLE
+	lvm_sample_stop(sampler);
+#endif
+	free(sampler->labels);
+	free(sampler->stacks);
+	free(sampler->frames);
+	free(sampler);
+}
+
+// private: get the location of the label a location belongs to (the location itself if no label comes before it)
+static size_t lvm_sample_label(const lvm_sampler_t* sampler, size_t pc)
+{
+	size_t lo = 0, hi = sampler->label_count;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if(sampler->labels[mid] <= pc) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo ? sampler->labels[lo - 1] : pc;
+}
+
+// private: double the amount of slots of the table of call stacks (returns false if unsuccessful)
+static int lvm_sample_grow(lvm_sampler_t* sampler)
+{
+	size_t capacity = sampler->capacity * 2;
+	lvm_sample_stack_t* stacks = calloc(capacity, sizeof(lvm_sample_stack_t));
+	if(!stacks) return 0;
+
+	size_t i; for(i = 0; i < sampler->capacity; i++)
+	{
+		if(!sampler->stacks[i].depth) continue;
+		size_t slot = sampler->stacks[i].hash & (capacity - 1);
+		while(stacks[slot].depth)
+			slot = (slot + 1) & (capacity - 1);
+		stacks[slot] = sampler->stacks[i];
+	}
+
+	free(sampler->stacks);
+	sampler->stacks = stacks;
+	sampler->capacity = capacity;
+	return 1;
+}
+
+// take a sample of the call stack (calls) of a vm which is about to run the instruction at pc
+void lvm_sample_record(lvm_sampler_t* sampler, const lvm_calls_t* calls, size_t pc)
+{
+	sampler->pending = 0;
+	++sampler->samples;
+
+	// the frames are the callers (the jsr before each return address) and then the location itself
+	size_t depth = calls->depth + 1;
+	size_t first = 0;
+	if(depth > SAMPLE_MAX_DEPTH)
+	{
+		first = depth - SAMPLE_MAX_DEPTH;
+		depth = SAMPLE_MAX_DEPTH;
+		++sampler->truncated;
+	}
+
+	if(sampler->frame_length + depth > sampler->frame_capacity)
+	{
+		size_t capacity = sampler->frame_capacity * 2;
+		size_t* frames = realloc(sampler->frames, capacity * sizeof(size_t));
+		if(!frames)
+		{
+			++sampler->dropped;
+			return;
+		}
+		sampler->frames = frames;
+		sampler->frame_capacity = capacity;
+	}
+
+	// the frames are written past the end of the pool and only kept if the call stack was not seen before
+	size_t* frames = sampler->frames + sampler->frame_length;
+	uint32_t hash = 2166136261u;
+	size_t i; for(i = 0; i < depth; i++)
+	{
+		size_t at = first + i < calls->depth ? calls->return_pcs[first + i] - 1 : pc;
+		frames[i] = lvm_sample_label(sampler, at);
+		hash = (hash ^ (uint32_t)frames[i]) * 16777619u;
+	}
+
+	size_t slot = hash & (sampler->capacity - 1);
+	while(sampler->stacks[slot].depth)
+	{
+		lvm_sample_stack_t* stack = &sampler->stacks[slot];
+		if(stack->hash == hash && stack->depth == depth &&
+			!memcmp(sampler->frames + stack->offset, frames, depth * sizeof(size_t)))
+		{
+			++stack->count;
+			return;
+		}
+		slot = (slot + 1) & (sampler->capacity - 1);
+	}
+
+	lvm_sample_stack_t* stack = &sampler->stacks[slot];
+	stack->hash = hash;
+	stack->offset = sampler->frame_length;
+	stack->depth = depth;
+	stack->count = 1;
+	sampler->frame_length += depth;
+
+	// keep the table at most half full
+	if(++sampler->length * 2 > sampler->capacity && !lvm_sample_grow(sampler))
+	{
+		stack->depth = 0;
+		--sampler->length;
+		sampler->frame_length -= depth;
+		++sampler->dropped;
+	}
+}
+
+// write the sampling profile of the last runs of the vm's loaded program as folded stacks (per call stack a line of
+// the labels of its frames separated by semicolons, outermost first, and the amount of samples, as read by flame graph
+// tools)
+void lvm_sample_report(lvm_t* vm, FILE* out)
+{
+	const lvm_sampler_t* sampler = vm->sampler;
+	if(!sampler)
+	{
+		fprintf(stderr, "WARNING: Nothing was sampled!\n");
+		return;
+	}
+
+	const lvm_bin_t* bin = lvm_prof_bin(vm);
+	size_t count = bin->header ? bin->header->sym_count : 0;
+	lvm_prof_entry_t* order = lvm_prof_symbols(bin);
+	lvm_prof_entry_t* entries = malloc((sampler->length + 1) * sizeof(lvm_prof_entry_t));
+	if(!order || !entries)
+	{
+		fprintf(stderr, "ERROR: Could not allocate the sample report!\n");
+		goto done;
+	}
+
+	// most sampled call stacks first
+	size_t n = 0;
+	size_t i; for(i = 0; i < sampler->capacity; i++)
+	{
+		if(!sampler->stacks[i].depth) continue;
+		entries[n].key = sampler->stacks[i].count;
+		entries[n].index = i;
+		++n;
+	}
+	qsort(entries, n, sizeof(lvm_prof_entry_t), lvm_prof_entry_cmp);
+
+	for(i = 0; i < n; i++)
+	{
+		const lvm_sample_stack_t* stack = &sampler->stacks[entries[i].index];
+		size_t k; for(k = 0; k < stack->depth; k++)
+		{
+			size_t pc = sampler->frames[stack->offset + k];
+			size_t symbol = lvm_prof_symbol(order, count, pc);
+			const char* name = symbol < count && order[symbol].key == pc ? lvm_bin_symbol_name(bin, order[symbol].index) : NULL;
+			if(k) fputc(';', out);
+			if(name)
+				fputs(name, out);
+			else
+				fprintf(out, "[%u]", (unsigned int)pc);
+		}
+		fprintf(out, " %llu\n", (unsigned long long)stack->count);
+	}
+
+	if(sampler->truncated)
+		fprintf(stderr, "WARNING: %llu samples kept only the innermost %u frames of their call stack\n",
+			(unsigned long long)sampler->truncated, SAMPLE_MAX_DEPTH);
+	if(sampler->dropped)
+		fprintf(stderr, "WARNING: %llu samples could not be stored\n", (unsigned long long)sampler->dropped);
+
+done:
+	free(order);
+	free(entries);
+}
+
+// run the currently loaded program by fetching, decoding and evaluating one instruction at a time
+void lvm_run_switch(lvm_t* vm)
+{
+	lvm_prof_t* prof = vm->profile ? vm->prof : NULL;
+#ifdef LVM_SAMPLE
+	lvm_sampler_t* sampler = vm->sample ? vm->sampler : NULL;
+#endif
+
+	while(vm->running)
+	{
+#ifdef LVM_SAMPLE
+		if(sampler && sampler->pending)
+			lvm_sample_record(sampler, &vm->calls, vm->pc);
+#endif
+		size_t pc = vm->pc;
+		lvm_fetch(vm);
+		lvm_decode(vm);
+		if(prof) lvm_prof_step(prof, pc, vm->instr_num, vm->limd);
+		lvm_eval(vm);
+	}
+}
+
+#ifdef LVM_THREADED
+
+/* dispatch to the handler of the next pre-decoded instruction (through the profiling or sampling table when they are
+ * in use) */
+#define T_DISPATCH()	goto *table[(ip++)->op]
+
+/* the instruction being executed (ip has already moved past it) */
+#define T_CUR	(ip[-1])
+
+/* take a branch (branch targets are where the jit counts block entries) */
+#ifdef LVM_JIT
+#define T_BRANCH(target)	do { ip = code + (target); if(jit) goto t_jit; } while(0)
+#else
+#define T_BRANCH(target)	(ip = code + (target))
+#endif
+
+/* keep the stack length register in sync after the stack changes */
+#define T_SYNC_ESL()	(regs[ESL_REG] = vm->stack.position)
+
+/* loads and stores of a width at a register plus an offset (copied bytewise, so the address need not be aligned) */
+#define T_LOAD(type) \
+	{ type value; memcpy(&value, (char*)regs[T_CUR.reg2] + T_CUR.immd, sizeof(value)); regs[T_CUR.reg1] = value; } \
+	T_DISPATCH()
+#define T_STORE(type) \
+	{ type value = regs[T_CUR.reg1]; memcpy((char*)regs[T_CUR.reg2] + T_CUR.immd, &value, sizeof(value)); } \
+	T_DISPATCH()
+
+/* fused compare-and-branch (the branch record after the compare is skipped when the branch is not taken) */
+#define T_CMPJ(cond) \
+	cmp1 = regs[T_CUR.reg1]; \
+	cmp2 = regs[T_CUR.reg2]; \
+	if(cmp1 cond cmp2) T_BRANCH(T_CUR.immd); \
+	else ip += 1; \
+	T_DISPATCH()
+
+// run the currently loaded program over its pre-decoded instructions using computed goto dispatch
+void lvm_run_threaded(lvm_t* vm)
+{
+	static void* dispatch[256] = 
+	{
+		[0 ... 255] = &&op_nop,
+		[HALT] = &&op_halt, [MOV] = &&op_mov, [ADD] = &&op_add, [SUB] = &&op_sub,
+		[MUL] = &&op_mul, [DIV] = &&op_div, [NEG] = &&op_neg, [PRT] = &&op_prt,
+		[PRTC] = &&op_prtc, [JMP] = &&op_jmp, [JNZ] = &&op_jnz, [JZ] = &&op_jz,
+		[JNE] = &&op_jne, [JE] = &&op_je, [JGT] = &&op_jgt, [JLT] = &&op_jlt,
+		[JGE] = &&op_jge, [JLE] = &&op_jle, [CMP] = &&op_cmp, [RET] = &&op_ret,
+		[MOVR] = &&op_movr, [CALL] = &&op_call, [PUSH] = &&op_push, [POP] = &&op_pop,
+		[SET] = &&op_set, [SETV] = &&op_setv, [GET] = &&op_get, [GETA] = &&op_geta,
+		[DREF] = &&op_dref, [ASL] = &&op_asl, [ASR] = &&op_asr, [MASK] = &&op_mask,
+		[PUSHI] = &&op_pushi, [JSR] = &&op_jsr, [STR] = &&op_str, [WRT] = &&op_wrt,
+		[LD8] = &&op_ld8, [LD16] = &&op_ld16, [LD32] = &&op_ld32, [LD64] = &&op_ld64,
+		[ST8] = &&op_st8, [ST16] = &&op_st16, [ST32] = &&op_st32, [ST64] = &&op_st64,
+		[MOVW] = &&op_movw, [MOVQ] = &&op_movq,
+		[CMPJNE] = &&op_cmpjne, [CMPJE] = &&op_cmpje, [CMPJGT] = &&op_cmpjgt, [CMPJLT] = &&op_cmpjlt,
+		[CMPJGE] = &&op_cmpjge, [CMPJLE] = &&op_cmpjle, [ADDI] = &&op_addi, [CALLV] = &&op_callv
+	};
+
+	// every opcode is counted before it is dispatched to its handler while profiling
+	static void* profiled[256] = { [0 ... 255] = &&t_profile };
+
+	lvm_prof_t* prof = vm->profile ? vm->prof : NULL;
+	void** base = prof ? profiled : dispatch;
+	void** table = base;
+
+#ifdef LVM_SAMPLE
+	// while sampling the table is one the timer signal can redirect (every dispatch loads its entry again, so the
+	// redirection is seen without making the loads volatile, which would slow down every instruction)
+	lvm_sampler_t* sampler = vm->sample ? vm->sampler : NULL;
+	if(sampler)
+	{
+		memcpy((void*)sampler->table, base, sizeof(sampler->table));
+		sampler->hook = &&t_sample;
+		table = (void**)sampler->table;
+	}
+#endif
+
+	const lvm_instr_t* code = vm->code;
+	const lvm_instr_t* ip = code + vm->pc;
+	intptr_t* regs = vm->regs;
+	intptr_t* db = vm->db.values;
+	const uint8_t* data = vm->data;
+	intptr_t cmp1 = vm->cmp1;
+	intptr_t cmp2 = vm->cmp2;
+
+#ifdef LVM_JIT
+	// compiled blocks are kept until another program is loaded (native code is not profiled, so it is not used then)
+	if(vm->use_jit && !prof && !vm->jit)
+		vm->jit = lvm_jit_create(code, vm->length);
+	lvm_jit_t* jit = vm->use_jit && !prof ? vm->jit : NULL;
+#endif
+
+	regs[ZERO_REG] = 0;
+	T_SYNC_ESL();
+
+	T_DISPATCH();
+
+#ifdef LVM_JIT
+t_jit:
+	{
+		// run the block at the branch target natively once it has been entered often enough
+		size_t target = ip - code;
+		lvm_jit_fn block = jit->blocks[target];
+		if(!block)
+		{
+			if(jit->counts[target] >= JIT_THRESHOLD || ++jit->counts[target] < JIT_THRESHOLD) T_DISPATCH();
+			block = lvm_jit_compile(jit, target);
+			if(!block) T_DISPATCH();
+		}
+
+		vm->cmp1 = cmp1;
+		vm->cmp2 = cmp2;
+		ip = code + block(vm);
+		cmp1 = vm->cmp1;
+		cmp2 = vm->cmp2;
+	}
+	T_DISPATCH();
+#endif
+
+#ifdef LVM_SAMPLE
+t_sample:
+	// the timer signal pointed every entry of the table at this handler, which samples the instruction about to run
+	// and points the table back at the handlers
+	lvm_sample_record(sampler, &vm->calls, ip - code - 1);
+	memcpy((void*)sampler->table, base, sizeof(sampler->table));
+	goto *base[T_CUR.op];
+#endif
+
+t_profile:
+	lvm_prof_step(prof, ip - code - 1, T_CUR.op, T_CUR.immd);
+	goto *dispatch[T_CUR.op];
+op_nop:
+	T_DISPATCH();
+op_halt:
+	vm->result = regs[T_CUR.reg1];
+t_exit:
+	vm->running = 0;
+	vm->pc = ip - code;
+	vm->cmp1 = cmp1;
+	vm->cmp2 = cmp2;
+	return;
+t_stack_overflow:
+	fprintf(stderr, "ERROR: Stack overflow at pc %u\n", (unsigned int)(ip - code - 1));
+	vm->result = 1;
+	goto t_exit;
+op_mov:
+	regs[T_CUR.reg1] = T_CUR.immd;
+	T_DISPATCH();
+op_movw:
+	regs[T_CUR.reg1] = T_CUR.immd;
+	ip += 1;
+	T_DISPATCH();
+op_movq:
+	regs[T_CUR.reg1] = T_CUR.immd;
+	ip += 2;
+	T_DISPATCH();
+op_add:
+	regs[T_CUR.reg1] = regs[T_CUR.reg2] + regs[T_CUR.reg3];
+	T_DISPATCH();
+op_sub:
+	regs[T_CUR.reg1] = regs[T_CUR.reg2] - regs[T_CUR.reg3];
+	T_DISPATCH();
+op_mul:
+	regs[T_CUR.reg1] = regs[T_CUR.reg2] * regs[T_CUR.reg3];
+	T_DISPATCH();
+op_div:
+	regs[T_CUR.reg1] = regs[T_CUR.reg2] / regs[T_CUR.reg3];
+	T_DISPATCH();
+op_neg:
+	regs[T_CUR.reg1] = -regs[T_CUR.reg1];
+	T_DISPATCH();
+op_prt:
+	lvm_output_int(&vm->output, regs[T_CUR.reg1]);
+	T_DISPATCH();
+op_prtc:
+	lvm_output_putc(&vm->output, (char)regs[T_CUR.reg1]);
+	T_DISPATCH();
+op_jmp:
+	T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jnz:
+	if(regs[T_CUR.reg1] != 0) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jz:
+	if(regs[T_CUR.reg1] == 0) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jne:
+	if(cmp1 != cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_je:
+	if(cmp1 == cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jgt:
+	if(cmp1 > cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jlt:
+	if(cmp1 < cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jge:
+	if(cmp1 >= cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_jle:
+	if(cmp1 <= cmp2) T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_cmp:
+	cmp1 = regs[T_CUR.reg1];
+	cmp2 = regs[T_CUR.reg2];
+	T_DISPATCH();
+op_ret:
+	// returning with no caller ends up on the trailing halt
+	T_BRANCH(lvm_calls_pop(&vm->calls, vm->length));
+	T_DISPATCH();
+op_jsr:
+	if(!lvm_calls_push(&vm->calls, ip - code))
+	{
+		fprintf(stderr, "ERROR: Call stack overflow at pc %u\n", (unsigned int)(ip - code - 1));
+		vm->result = 1;
+		goto t_exit;
+	}
+	T_BRANCH(T_CUR.immd);
+	T_DISPATCH();
+op_movr:
+	regs[T_CUR.reg1] = regs[T_CUR.reg2];
+	T_DISPATCH();
+op_call:
+	// bound functions read their arguments through the decoded fields
+	vm->reg1 = T_CUR.reg1;
+	vm->reg2 = T_CUR.reg2;
+	vm->reg3 = T_CUR.reg3;
+	vm->reg4 = T_CUR.reg4;
+	vm->pc = ip - code;
+	lvm_cint_call(vm->cint, vm, regs[T_CUR.reg1]);
+	regs[ZERO_REG] = 0;
+	T_SYNC_ESL();
+	// a bound function stops the vm by clearing running (keeping the result it set)
+	if(!vm->running) goto t_exit;
+	T_DISPATCH();
+op_push:
+	if(!lvm_stack_push(&vm->stack, regs[T_CUR.reg1])) goto t_stack_overflow;
+	T_SYNC_ESL();
+	T_DISPATCH();
+op_pop:
+	regs[T_CUR.reg1] = lvm_stack_pop(&vm->stack);
+	T_SYNC_ESL();
+	T_DISPATCH();
+op_set:
+	db[T_CUR.immd] = regs[T_CUR.reg1];
+	T_DISPATCH();
+op_setv:
+	*(intptr_t*)(regs[T_CUR.reg1]) = regs[T_CUR.reg2];
+	T_DISPATCH();
+op_get:
+	regs[T_CUR.reg1] = db[T_CUR.immd];
+	T_DISPATCH();
+op_geta:
+	regs[T_CUR.reg1] = (intptr_t)(&db[T_CUR.immd]);
+	T_DISPATCH();
+op_dref:
+	regs[T_CUR.reg1] = *(intptr_t*)(regs[T_CUR.reg2]);
+	T_DISPATCH();
+op_asl:
+	regs[T_CUR.reg1] <<= regs[T_CUR.reg2];
+	T_DISPATCH();
+op_asr:
+	regs[T_CUR.reg1] >>= regs[T_CUR.reg2];
+	T_DISPATCH();
+op_mask:
+	regs[T_CUR.reg1] = regs[T_CUR.reg1] & regs[T_CUR.reg2];
+	T_DISPATCH();
+op_pushi:
+	if(!lvm_stack_push(&vm->stack, T_CUR.immd)) goto t_stack_overflow;
+	T_SYNC_ESL();
+	T_DISPATCH();
+op_str:
+	regs[T_CUR.reg1] = (intptr_t)(data + T_CUR.immd);
+	T_DISPATCH();
+op_wrt:
+	lvm_output_write(&vm->output, (const void*)regs[T_CUR.reg1], (size_t)regs[T_CUR.reg2]);
+	T_DISPATCH();
+op_ld8:
+	T_LOAD(uint8_t);
+op_ld16:
+	T_LOAD(uint16_t);
+op_ld32:
+	T_LOAD(uint32_t);
+op_ld64:
+	T_LOAD(uint64_t);
+op_st8:
+	T_STORE(uint8_t);
+op_st16:
+	T_STORE(uint16_t);
+op_st32:
+	T_STORE(uint32_t);
+op_st64:
+	T_STORE(uint64_t);
+
+	// fused instructions skip the records they were fused with when they fall through
+op_cmpjne:
+	T_CMPJ(!=);
+op_cmpje:
+	T_CMPJ(==);
+op_cmpjgt:
+	T_CMPJ(>);
+op_cmpjlt:
+	T_CMPJ(<);
+op_cmpjge:
+	T_CMPJ(>=);
+op_cmpjle:
+	T_CMPJ(<=);
+op_addi:
+	regs[T_CUR.reg1] = T_CUR.immd;
+	regs[T_CUR.reg2] = regs[T_CUR.reg3] + regs[T_CUR.reg4];
+	ip += 1;
+	T_DISPATCH();
+op_callv:
+	{
+		const lvm_instr_t* instr = ip - 1;
+		if(!lvm_stack_push(&vm->stack, regs[instr->reg1])) goto t_stack_overflow;
+		T_SYNC_ESL();
+		regs[instr->reg1] = db[instr->immd];
+		vm->reg1 = instr->reg1;
+		vm->reg2 = instr->reg2;
+		vm->reg3 = instr->reg3;
+		vm->reg4 = instr->reg4;
+		// the bound function sees the pc of the pop, as it does after an unfused call
+		vm->pc = ip - code + 2;
+		ip += 3;
+		lvm_cint_call(vm->cint, vm, regs[instr->reg1]);
+		regs[ZERO_REG] = 0;
+		if(!vm->running)
+		{
+			T_SYNC_ESL();
+			goto t_exit;
+		}
+		regs[instr->reg1] = lvm_stack_pop(&vm->stack);
+		T_SYNC_ESL();
+	}
+	T_DISPATCH();
+}
+
+#undef T_DISPATCH
+#undef T_CUR
+#undef T_BRANCH
+#undef T_SYNC_ESL
+#undef T_CMPJ
+
+#endif
+
+// run the currently loaded program on the vm
+int lvm_run(lvm_t* vm)
+{
+	if(vm->running) return 0;
+	if(!vm->program) return 0;
+	vm->running = 1;
+
+	// the profile covers every run of the loaded program until another one is loaded
+	if(vm->profile && !vm->prof && !(vm->prof = lvm_prof_create(vm->length)))
+		fprintf(stderr, "WARNING: Could not allocate the profile, the program runs unprofiled!\n");
+	uint64_t start = vm->prof ? lvm_prof_now() : 0;
+
+#ifdef LVM_SAMPLE
+	if(vm->sample && !vm->sampler && !(vm->sampler = lvm_sample_create(lvm_prof_bin(vm), vm->sample)))
+		fprintf(stderr, "WARNING: Could not allocate the sampling profile, the program runs unsampled!\n");
+	int sampling = vm->sample && vm->sampler && lvm_sample_start(vm->sampler);
+	if(vm->sample && vm->sampler && !sampling)
+		fprintf(stderr, "WARNING: Could not start the sampling timer, the program runs unsampled!\n");
+#endif
+
+#ifdef LVM_THREADED
+	if(!vm->debug)
+		lvm_run_threaded(vm);
+	else
+		lvm_run_switch(vm);
+#else
+	lvm_run_switch(vm);
+#endif
+
+	if(vm->profile && vm->prof)
+	{
+		vm->prof->elapsed += lvm_prof_now() - start;
+		lvm_prof_finish(vm->prof);
+	}
+#ifdef LVM_SAMPLE
+	if(sampling)
+		lvm_sample_stop(vm->sampler);
+#endif
+
+	// whatever the program printed is written once it stops
+	lvm_output_flush(&vm->output);
+
+	vm->pc = 0;
+
+	return vm->result;
+}
+
+// push a value onto the stack of the vm (stops the vm with a result of 1 if the stack is full, when called from a bound
+// function the vm stops once the function returns)
+void lvm_push(lvm_t* vm, intptr_t value)
+{
+	if(!lvm_stack_push(&vm->stack, value))
+	{
+		fprintf(stderr, "ERROR: Stack overflow at pc %u\n", (unsigned int)(vm->pc - 1));
+		vm->running = 0;
+		vm->result = 1;
+	}
+}
+
+// pop a value from the stack of the vm
+intptr_t lvm_pop(lvm_t* vm)
+{
+	return lvm_stack_pop(&vm->stack);
+}
+
+// close the vm, freeing everything it allocated
+void lvm_close(lvm_t* vm)
+{
+	lvm_reset(vm);
+	lvm_stack_free(&vm->stack);
+	lvm_calls_free(&vm->calls);
+	lvm_output_free(&vm->output);
+	lvm_input_free(&vm->input);
+	if(vm->owns_cint)
+		lvm_cint_destroy(vm->cint);
+	vm->cint = NULL;
+	vm->owns_cint = 0;
+}
+
+#ifdef LVM_BATCH
+
+// private: initialize a job queue (returns true if successful)
+static int lvm_deque_init(lvm_deque_t* deque)
+{
+	deque->head = 0;
+	deque->length = 0;
+	deque->capacity = 0x40;
+	deque->jobs = malloc(deque->capacity * sizeof(lvm_job_t*));
+	if(!deque->jobs) return 0;
+
+	pthread_mutex_init(&deque->lock, NULL);
+	return 1;
+}
+
+// private: free a job queue
+static void lvm_deque_free(lvm_deque_t* deque)
+{
+	pthread_mutex_destroy(&deque->lock);
+	free(deque->jobs);
+	deque->jobs = NULL;
+}
+
+// private: add a job at the newest end of a queue (returns true if successful)
+static int lvm_deque_push(lvm_deque_t* deque, lvm_job_t* job)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if(deque->length == deque->capacity)
+	{
+		lvm_job_t** jobs = malloc(deque->capacity * 2 * sizeof(lvm_job_t*));
+		if(!jobs)
+		{
+			pthread_mutex_unlock(&deque->lock);
+			return 0;
+		}
+
+		size_t i; for(i = 0; i < deque->length; i++)
+			jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+
+		free(deque->jobs);
+		deque->jobs = jobs;
+		deque->head = 0;
+		deque->capacity *= 2;
+	}
+
+	deque->jobs[(deque->head + deque->length) % deque->capacity] = job;
+	++deque->length;
+
+	pthread_mutex_unlock(&deque->lock);
+	return 1;
+}
+
+// private: take the newest job from a queue (returns NULL if it is empty)
+static lvm_job_t* lvm_deque_pop(lvm_deque_t* deque)
+{
+	lvm_job_t* job = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->length > 0)
+	{
+		--deque->length;
+		job = deque->jobs[(deque->head + deque->length) % deque->capacity];
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return job;
+}
+
+// private: take the oldest job from a queue (returns NULL if it is empty)
+static lvm_job_t* lvm_deque_steal(lvm_deque_t* deque)
+{
+	lvm_job_t* job = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if(deque->length > 0)
+	{
+		job = deque->jobs[deque->head];
+		deque->head = (deque->head + 1) % deque->capacity;
+		--deque->length;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return job;
+}
+
+// private: find a job for a worker, stealing from the other workers once its own queue is empty
+static lvm_job_t* lvm_batch_take(lvm_batch_t* batch, size_t id)
+{
+	lvm_job_t* job = lvm_deque_pop(&batch->queues[id]);
+
+	size_t i; for(i = 1; !job && i < batch->workers; i++)
+		job = lvm_deque_steal(&batch->queues[(id + i) % batch->workers]);
+
+	return job;
+}
+
+// private: worker thread, runs jobs on the worker's vm until the batch is closed and every queue is empty
+static void* lvm_batch_work(void* arg)
+{
+	lvm_worker_t* worker = arg;
+	lvm_batch_t* batch = worker->batch;
+
+	for(;;)
+	{
+		lvm_job_t* job = lvm_batch_take(batch, worker->id);
+
+		if(!job)
+		{
+			pthread_mutex_lock(&batch->lock);
+			while(batch->queued <= 0 && !batch->closing)
+			{
+				++batch->sleeping;
+				pthread_cond_wait(&batch->work, &batch->lock);
+				--batch->sleeping;
+			}
+			int finished = batch->queued <= 0 && batch->closing;
+			pthread_mutex_unlock(&batch->lock);
+
+			if(finished) break;
+			continue;
+		}
+
+		pthread_mutex_lock(&batch->lock);
+		--batch->queued;
+		pthread_mutex_unlock(&batch->lock);
+
+		lvm_rewind(worker->vm);
+
+		size_t i; for(i = 0; i < job->argc; i++)
+			if(!lvm_stack_push(&worker->vm->stack, job->args[i])) break;
+
+		if(i < job->argc)
+		{
+			fprintf(stderr, "ERROR: Too many arguments on input line %u (the stack holds %u)\n",
+				(unsigned int)(job->index + 1), (unsigned int)i);
+			job->result = 1;
+		}
+		else
+			job->result = lvm_run(worker->vm);
+
+		// publish the result
+		pthread_mutex_lock(&batch->lock);
+		job->next = NULL;
+		if(batch->results_tail)
+			batch->results_tail->next = job;
+		else
+			batch->results = job;
+		batch->results_tail = job;
+		if(batch->collecting)
+			pthread_cond_signal(&batch->done);
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	return NULL;
+}
+
+// create a batch executor with a fixed pool of workers (each with its own vm made from config) running image (returns NULL if unsuccessful)
+lvm_batch_t* lvm_batch_create(lvm_image_t* image, const lvm_config_t* config, size_t workers)
+{
+	if(workers == 0) return NULL;
+
+	lvm_batch_t* batch = malloc(sizeof(lvm_batch_t));
+	if(!batch) return NULL;
+
+	batch->image = lvm_image_retain(image);
+	batch->workers = 0;
+	batch->started = 0;
+	batch->pool = calloc(workers, sizeof(lvm_worker_t));
+	batch->queues = calloc(workers, sizeof(lvm_deque_t));
+	batch->next_queue = 0;
+	batch->queued = 0;
+	batch->outstanding = 0;
+	batch->closing = 0;
+	batch->sleeping = 0;
+	batch->collecting = 0;
+	batch->results = NULL;
+	batch->results_tail = NULL;
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->work, NULL);
+	pthread_cond_init(&batch->done, NULL);
+
+	if(!batch->pool || !batch->queues)
+	{
+		lvm_batch_destroy(batch);
+		return NULL;
+	}
+
+	// every queue and vm exists before the first worker starts looking for jobs to steal
+	size_t i; for(i = 0; i < workers; i++)
+	{
+		lvm_worker_t* worker = &batch->pool[i];
+		worker->batch = batch;
+		worker->id = i;
+		worker->vm = lvm_create(config);
+
+		if(!worker->vm || !lvm_attach(worker->vm, image) || !lvm_deque_init(&batch->queues[i]))
+		{
+			lvm_destroy(worker->vm);
+			lvm_batch_destroy(batch);
+			return NULL;
+		}
+
+		++batch->workers;
+	}
+
+	for(i = 0; i < workers; i++)
+	{
+		if(pthread_create(&batch->pool[i].thread, NULL, &lvm_batch_work, &batch->pool[i]) != 0)
+		{
+			lvm_batch_destroy(batch);
+			return NULL;
+		}
+
+		++batch->started;
+	}
+
+	return batch;
+}
+
+// submit a job to the batch, the batch hands it back through lvm_batch_result once it ran (returns true if successful)
+int lvm_batch_submit(lvm_batch_t* batch, lvm_job_t* job)
+{
+	if(!lvm_deque_push(&batch->queues[batch->next_queue], job))
+		return 0;
+	batch->next_queue = (batch->next_queue + 1) % batch->workers;
+
+	pthread_mutex_lock(&batch->lock);
+	++batch->queued;
+	++batch->outstanding;
+	if(batch->sleeping > 0)
+		pthread_cond_signal(&batch->work);
+	pthread_mutex_unlock(&batch->lock);
+
+	return 1;
+}
+
+// signal that no more jobs will be submitted (workers exit once the queues are drained)
+void lvm_batch_close(lvm_batch_t* batch)
+{
+	pthread_mutex_lock(&batch->lock);
+	batch->closing = 1;
+	pthread_cond_broadcast(&batch->work);
+	pthread_mutex_unlock(&batch->lock);
+}
+
+// wait for the next finished job in completion order (returns NULL once every submitted job has been collected)
+lvm_job_t* lvm_batch_result(lvm_batch_t* batch)
+{
+	pthread_mutex_lock(&batch->lock);
+
+	while(!batch->results && batch->outstanding > 0)
+	{
+		batch->collecting = 1;
+		pthread_cond_wait(&batch->done, &batch->lock);
+		batch->collecting = 0;
+	}
+
+	lvm_job_t* job = batch->results;
+	if(job)
+	{
+		batch->results = job->next;
+		if(!batch->results)
+			batch->results_tail = NULL;
+		--batch->outstanding;
+	}
+
+	pthread_mutex_unlock(&batch->lock);
+	return job;
+}
+
+// close the batch, wait for the workers to finish and free it (uncollected jobs are not freed)
+void lvm_batch_destroy(lvm_batch_t* batch)
+{
+	if(!batch) return;
+
+	lvm_batch_close(batch);
+
+	size_t i; for(i = 0; i < batch->started; i++)
+		pthread_join(batch->pool[i].thread, NULL);
+
+	for(i = 0; i < batch->workers; i++)
+	{
+		lvm_destroy(batch->pool[i].vm);
+		lvm_deque_free(&batch->queues[i]);
+	}
+
+	pthread_cond_destroy(&batch->done);
+	pthread_cond_destroy(&batch->work);
+	pthread_mutex_destroy(&batch->lock);
+	free(batch->queues);
+	free(batch->pool);
+	lvm_image_release(batch->image);
+	free(batch);
+}
+
+// private: make a job out of a line of whitespace separated integers (returns NULL if unsuccessful)
+static lvm_job_t* lvm_batch_parse_job(const char* line, size_t index)
+{
+	lvm_job_t* job = malloc(sizeof(lvm_job_t));
+	if(!job) return NULL;
+
+	job->index = index;
+	job->argc = 0;
+	job->result = 0;
+	job->next = NULL;
+
+	size_t capacity = 4;
+	job->args = malloc(capacity * sizeof(intptr_t));
+
+	const char* pos = line;
+	while(job->args)
+	{
+		char* end;
+		intptr_t value = (intptr_t)strtoll(pos, &end, 0);
+		if(end == pos) break;
+		pos = end;
+
+		if(job->argc == capacity)
+		{
+			capacity *= 2;
+			intptr_t* args = realloc(job->args, capacity * sizeof(intptr_t));
+			if(!args)
+			{
+				free(job->args);
+				job->args = NULL;
+				break;
+			}
+			job->args = args;
+		}
+		job->args[job->argc++] = value;
+	}
+
+	if(!job->args)
+	{
+		free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+// private: collect one result and write out every result that is now next in input order
+static void lvm_batch_collect(lvm_batch_t* batch, lvm_job_t** ready, size_t window, size_t* written, FILE* output)
+{
+	lvm_job_t* job = lvm_batch_result(batch);
+	if(!job) return;
+
+	ready[job->index % window] = job;
+
+	while((job = ready[*written % window]) != NULL)
+	{
+		fprintf(output, "%d\n", job->result);
+		ready[*written % window] = NULL;
+		free(job->args);
+		free(job);
+		++*written;
+	}
+}
+
+// run image once for every line of input (each line holds the integer arguments pushed onto the stack, in order),
+// writing the value every run halted with to output in input order (returns true if successful)
+int lvm_batch_stream(lvm_image_t* image, const lvm_config_t* config, size_t workers, FILE* input, FILE* output)
+{
+	lvm_batch_t* batch = lvm_batch_create(image, config, workers);
+	if(!batch) return 0;
+
+	// bounds the memory used by jobs waiting to be run or written
+	size_t window = workers * BATCH_WINDOW_PER_WORKER;
+	lvm_job_t** ready = calloc(window, sizeof(lvm_job_t*));
+	if(!ready)
+	{
+		lvm_batch_destroy(batch);
+		return 0;
+	}
+
+	int ok = 1;
+	size_t submitted = 0;
+	size_t written = 0;
+	char* line = NULL;
+	size_t line_capacity = 0;
+
+	while(getline(&line, &line_capacity, input) != -1)
+	{
+		// once the window fills up, drain half of it so that the reader doesn't wake up for every result
+		if(submitted - written >= window)
+		{
+			while(submitted - written > window / 2)
+				lvm_batch_collect(batch, ready, window, &written, output);
+		}
+
+		lvm_job_t* job = lvm_batch_parse_job(line, submitted);
+		if(!job || !lvm_batch_submit(batch, job))
+		{
+			if(job)
+			{
+				free(job->args);
+				free(job);
+			}
+			ok = 0;
+			break;
+		}
+		++submitted;
+	}
+
+	lvm_batch_close(batch);
+	while(written < submitted)
+		lvm_batch_collect(batch, ready, window, &written, output);
+
+	free(line);
+	free(ready);
+	lvm_batch_destroy(batch);
+	return ok;
+}
+
+#endif
+
+// bound functions 
+
+void lvm_fnmalloc(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = (intptr_t)malloc((size_t)vm->regs[vm->reg3]);
+}
+
+void lvm_fnrealloc(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = (intptr_t)realloc((void*)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+}
+
+void lvm_fnfree(lvm_t* vm)
+{
+	free((void*)vm->regs[vm->reg2]);
+}
+
+void lvm_fnset(lvm_t* vm)
+{
+	memset((void*)vm->regs[vm->reg2], (int)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+}
+
+void lvm_fncpy(lvm_t* vm)
+{
+	memcpy((void*)vm->regs[vm->reg2], (void*)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+}
+
+void lvm_fntobyte(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = (uint8_t)(*(intptr_t*)vm->regs[vm->reg2]);
+}
+
+void lvm_fntodbyte(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = (uint16_t)(*(intptr_t*)vm->regs[vm->reg2]);
+}
+
+void lvm_fntoword(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = *(uint32_t*)vm->regs[vm->reg2];
+}
+
+void lvm_fntodword(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = *(uint64_t*)vm->regs[vm->reg2]; 
+}
+
+void lvm_fnflush(lvm_t* vm)
+{
+	lvm_flush(vm);
+}
+
+void lvm_fnstrlen(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = strlen((const char*)vm->regs[vm->reg3]);
+}
+
+void lvm_fnread(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = lvm_input_read(&vm->input, (void*)vm->regs[vm->reg3], (size_t)vm->regs[vm->reg4]);
+}
+
+void lvm_fnrecord(lvm_t* vm)
+{
+	size_t length;
+	const char* record = lvm_input_record(&vm->input, (char)vm->regs[vm->reg4], &length);
+	vm->regs[vm->reg2] = (intptr_t)record;
+	vm->regs[vm->reg3] = length;
+}
+
+void lvm_fnopen(lvm_t* vm)
+{
+	vm->regs[vm->reg2] = lvm_openinput(vm, (const char*)vm->regs[vm->reg3]);
+}
+
+void lvm_fnmmap(lvm_t* vm)
+{
+	// the file is mapped read-only, where mapping is not available it is read into memory instead
+	FILE* file = fopen((const char*)vm->regs[vm->reg4], "rb");
+	vm->regs[vm->reg2] = 0;
+	vm->regs[vm->reg3] = 0;
+	if(!file) return;
+
+	void* base = NULL;
+	size_t size = 0;
+
+#ifdef _WIN32
+	if(fseek(file, 0, SEEK_END) == 0)
+	{
+		long end = ftell(file);
+		rewind(file);
+		if(end > 0 && (base = calloc(end + MMAP_SLACK, 1)) && fread(base, 1, end, file) != (size_t)end)
+		{
+			free(base);
+			base = NULL;
+		}
+		size = base ? end : 0;
+	}
+#else
+	struct stat info;
+	if(fstat(fileno(file), &info) == 0 && info.st_size > 0)
+	{
+		// the file is mapped over zeroed memory reaching past its end, so that word wide reads of its last bytes stay
+		// within the mapping (even when the file ends on a page boundary)
+		size_t length = info.st_size + MMAP_SLACK;
+		base = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(base != MAP_FAILED &&
+			mmap(base, info.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(file), 0) == MAP_FAILED)
+		{
+			munmap(base, length);
+			base = MAP_FAILED;
+		}
+		if(base == MAP_FAILED)
+			base = NULL;
+		size = base ? info.st_size : 0;
+	}
+#endif
+
+	fclose(file);
+	vm->regs[vm->reg2] = (intptr_t)base;
+	vm->regs[vm->reg3] = size;
+}
+
+void lvm_fnmunmap(lvm_t* vm)
+{
+	if(!vm->regs[vm->reg2]) return;
+
+#ifdef _WIN32
+	free((void*)vm->regs[vm->reg2]);
+#else
+	munmap((void*)vm->regs[vm->reg2], (size_t)vm->regs[vm->reg3] + MMAP_SLACK);
+#endif
+}
+
+void lvm_fnmadvise(lvm_t* vm)
+{
+#ifndef _WIN32
+	// the range has to start on a page boundary
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)vm->regs[vm->reg2];
+	uintptr_t aligned = start & ~(page - 1);
+	int advice;
+
+	switch(vm->regs[vm->reg4])
+	{
+	case ADVICE_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+	case ADVICE_RANDOM: advice = MADV_RANDOM; break;
+	case ADVICE_WILLNEED: advice = MADV_WILLNEED; break;
+	case ADVICE_DONTNEED: advice = MADV_DONTNEED; break;
+	default: advice = MADV_NORMAL; break;
+	}
+
+	if(start)
+		madvise((void*)aligned, (size_t)vm->regs[vm->reg3] + (start - aligned), advice);
+#endif
+}
+
+// end of bound functions
+
+// create a binding table holding the built-in functions (returns NULL if unsuccessful)
+lvm_cint_t* lvm_builtins_create(void)
+{
+	lvm_cint_t* builtins = lvm_cint_create();
+	if(!builtins) return NULL;
+
+	lvm_cint_bind(builtins, &lvm_fnmalloc, 0);
+	lvm_cint_bind(builtins, &lvm_fnfree, 1);
+	lvm_cint_bind(builtins, &lvm_fnset, 2);
+	lvm_cint_bind(builtins, &lvm_fncpy, 3);
+	lvm_cint_bind(builtins, &lvm_fntobyte, 4);
+	lvm_cint_bind(builtins, &lvm_fntodbyte, 5);
+	lvm_cint_bind(builtins, &lvm_fntoword, 6);
+	lvm_cint_bind(builtins, &lvm_fntodword, 7);
+	lvm_cint_bind(builtins, &lvm_fnrealloc, 8);
+	lvm_cint_bind(builtins, &lvm_fnflush, 9);
+	lvm_cint_bind(builtins, &lvm_fnstrlen, 10);
+	lvm_cint_bind(builtins, &lvm_fnread, 11);
+	lvm_cint_bind(builtins, &lvm_fnrecord, 12);
+	lvm_cint_bind(builtins, &lvm_fnopen, 13);
+	lvm_cint_bind(builtins, &lvm_fnmmap, 14);
+	lvm_cint_bind(builtins, &lvm_fnmunmap, 15);
+	lvm_cint_bind(builtins, &lvm_fnmadvise, 16);
+
+	return builtins;
+}
+
+#ifndef LVM_NO_MAIN
+int main(int argc, char* argv[])
+{
+	const char* filename = NULL;
+	int debug = 0;
+	int batch = 0;
+	int jit = 0;
+	int profile = 0;
+	const char* folded = NULL;
+	size_t workers = 0;
+
+	int i; for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-jit"))
+			jit = 1;
+		else if(!strcmp(argv[i], "-prof"))
+			profile = 1;
+		else if(!strcmp(argv[i], "-sample") && i + 1 < argc)
+			folded = argv[++i];
+		else if(!strcmp(argv[i], "-batch") && i + 1 < argc)
+		{
+			batch = 1;
+			workers = strtoul(argv[++i], NULL, 10);
+		}
+		else if(!filename && argv[i][0] == '-' && argv[i][1])
+		{
+			debug = 1;
+			filename = argv[i] + 1;
+		}
+		else if(!filename)
+			filename = argv[i];
+		else
+		{
+			filename = NULL;
+			break;
+		}
+	}
+
+	if(!filename)
+	{
+		fprintf(stderr, "ERROR: Invalid command line arguments (lvm program.path.here, lvm -program.path.here to debug, lvm -batch workers program.path.here < inputs, -jit before either to compile hot code, -prof to write a profile to stderr, -sample out.folded to write sampled call stacks)\n");
+		return 1;
+	}
+
+	lvm_cint_t* builtins = lvm_builtins_create();
+	lvm_image_t* image = lvm_image_read(filename);
+	if(!builtins || !image)
+	{
+		fprintf(stderr, "ERROR: Could not read file\n");
+		lvm_image_release(image);
+		lvm_cint_destroy(builtins);
+		return 1;
+	}
+
+#ifndef LVM_SAMPLE
+	if(folded)
+	{
+		fprintf(stderr, "ERROR: Sampling is not available in this build\n");
+		folded = NULL;
+	}
+#endif
+
+	lvm_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.cint = builtins;
+	config.jit = jit;
+
+	int res = 1;
+
+	if(batch)
+	{
+#ifdef LVM_BATCH
+		// zero workers means one per core
+		if(workers == 0)
+		{
+			long cores = sysconf(_SC_NPROCESSORS_ONLN);
+			workers = cores > 0 ? cores : 1;
+		}
+
+		if(lvm_batch_stream(image, &config, workers, stdin, stdout))
+			res = 0;
+		else
+			fprintf(stderr, "ERROR: Batch execution failed\n");
+#else
+		fprintf(stderr, "ERROR: Batch execution is not available in this build\n");
+#endif
+	}
+	else
+	{
+		lvm_t* vm = lvm_create(&config);
+		if(vm && lvm_attach(vm, image))
+		{
+			lvm_setdbg(vm, debug);
+			lvm_setprof(vm, profile);
+			lvm_setsample(vm, folded ? SAMPLE_RATE : 0);
+			res = lvm_run(vm);
+			if(profile)
+				lvm_prof_report(vm, stderr);
+			if(folded)
+			{
+				FILE* out = fopen(folded, "w");
+				if(out)
+				{
+					lvm_sample_report(vm, out);
+					fclose(out);
+				}
+				else
+					fprintf(stderr, "ERROR: Could not open %s\n", folded);
+			}
+		}
+		else
+			fprintf(stderr, "ERROR: Could not create the vm\n");
+		lvm_destroy(vm);
+	}
+
+	lvm_image_release(image);
+	lvm_cint_destroy(builtins);
+	return res;
+}
+#endif
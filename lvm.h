@@ -4,9 +4,14 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <signal.h>
 
-/* maximum jump depth */
-#define MAX_JUMP_DEPTH	0xFF
+#if !defined(_WIN32) && !defined(LVM_NO_BATCH)
+#include <pthread.h>
+#endif
+
+/* maximum call depth */
+#define MAX_CALL_DEPTH	0xFFFF
 
 /* maximum amount of bound c functions */
 #define MAX_BIND_AMT	0xFFFF
@@ -14,6 +19,26 @@
 /* maximum stack depth */
 #define MAX_STACK_DEPTH	0xFFFF
 
+/* initial capacity of the stack and the call stack (both are allocated on first use and grow on demand) */
+#define INITIAL_STACK_CAPACITY	0x40
+#define INITIAL_CALL_CAPACITY	0x10
+
+/* size of the buffer guest output (prt, ptc and wrt) is collected in before it is written */
+#define OUTPUT_BUFFER_SIZE	0x10000
+
+/* size of the read ahead buffer guest input is read through (it grows to hold the longest record read) */
+#define INPUT_BUFFER_SIZE	0x10000
+
+/* zeroed bytes the mmap builtin places after a file (a word read at its last byte stays within the mapping) */
+#define MMAP_SLACK	sizeof(intptr_t)
+
+/* access hints of the madvise builtin */
+#define ADVICE_NORMAL		0		// no particular order
+#define ADVICE_SEQUENTIAL	1		// read from start to end (read ahead aggressively, drop pages once read)
+#define ADVICE_RANDOM		2		// read in no particular order (do not read ahead)
+#define ADVICE_WILLNEED		3		// read soon (start reading it in)
+#define ADVICE_DONTNEED		4		// not read again soon (its pages can be dropped)
+
 /* maximum amount of variables */
 #define MAX_VARIABLE_AMT 0xFFFF
 
@@ -25,6 +50,11 @@
 #define REG4_MASK	0x00000F00
 #define IMMVL_MASK	0x000FFFFF
 #define LIMMVL_MASK	0x00FFFFFF
+#define OFFSET_MASK	0x0000FFFF
+#define BRANCH_MASK	0x000000FF
+
+/* amount of words an instruction takes (the wide instructions are followed by their immediate) */
+#define INSTR_WORDS(word)	((word) >> 24 == MOVQ ? 3 : (word) >> 24 == MOVW || (word) >> 24 == LONG ? 2 : 1)
 
 /* special registers */
 #define ZERO_REG	0x0
@@ -50,7 +80,7 @@
 #define JGE			0x10 		// jge ...
 #define JLE 		0x11 		// jle ...
 #define CMP 		0x12 		// cmp %eax %gr1
-#define RET 		0x13 		// ret @label_to_return_from_here
+#define RET 		0x13 		// ret @label_to_return_from_here (returns to the most recent jsr)
 #define MOVR		0x14 		// movr %eax %gr1 
 #define CALL 		0x15		// call %eax %zero %zero %zero
 #define PUSH		0x16		// push %eax
@@ -64,6 +94,39 @@
 #define ASR 		0x24		// asr %eax %gr2
 #define MASK		0x25 		// mask %eax %gr1
 #define PUSHI		0x26 		// pushi 'a'
+#define JSR			0x27		// jsr @label_name_here
+#define STR			0x28		// str %eax "text" (address of the literal in the data section)
+
+/* marks the end of the code in a program, its long immediate is the length of the data section in bytes and the data
+ * follows it (padded to whole words) */
+#define DATA		0x29
+
+#define WRT			0x2A		// wrt %eax %gr1 (writes %gr1 bytes starting at the address in %eax to the output)
+#define LD8			0x2B		// ld8 %eax %gr1 4 (loads the byte at the address in %gr1 plus 4, zero extended)
+#define LD16		0x2C		// ld16 ...
+#define LD32		0x2D		// ld32 ...
+#define LD64		0x2E		// ld64 ...
+#define ST8			0x2F		// st8 %eax %gr1 4 (stores the low byte of %eax at the address in %gr1 plus 4)
+#define ST16		0x30		// st16 ...
+#define ST32		0x31		// st32 ...
+#define ST64		0x32		// st64 ...
+
+/* wide instructions (lasm picks them when an immediate does not fit its instruction word), their immediate is held by
+ * the words after them */
+#define MOVW		0x33		// mov %eax -5 (sign extended 32 bit immediate in the next word)
+#define MOVQ		0x34		// mov %eax 4294967296 (64 bit immediate in the next two words, low word first)
+#define LONG		0x35		// jnz %eax @far (opcode of the branch in the low byte, its target in the next word)
+
+/* internal instructions (only produced by the pre-decoder) */
+#define CMPJNE		0xF0		// cmp followed by jne
+#define CMPJE		0xF1		// cmp followed by je
+#define CMPJGT		0xF2		// cmp followed by jgt
+#define CMPJLT		0xF3		// cmp followed by jlt
+#define CMPJGE		0xF4		// cmp followed by jge
+#define CMPJLE		0xF5		// cmp followed by jle
+#define ADDI		0xF6		// mov of an immediate followed by an add using it (i.e. an increment)
+#define CALLV		0xF7		// push %x, get %x #fn, call %x ..., pop %x (save-call-restore)
+#define NOP			0xFF		// does nothing
 
 /* instruction encoding macros */
 #define ENCODE_IRVV(instr, reg, immv)					((instr) << 24 | (reg) << 20 | (immv))
@@ -72,18 +135,81 @@
 #define ENCODE_IRRRV(instr, reg1, reg2, reg3, immv)		((instr) << 24 | (reg1) << 20 | (reg2) << 16 | (reg3) << 12 | (immv))
 #define ENCODE_IVVV(instr, immv)						((instr) << 24 | (immv))
 #define ENCODE_IR00(instr, reg)							((instr) << 24 | (reg) << 20)
+#define ENCODE_IRRRR(instr, reg1, reg2, reg3, reg4)		((instr) << 24 | (reg1) << 20 | (reg2) << 16 | (reg3) << 12 | (reg4) << 8)
+#define ENCODE_IRRV(instr, reg1, reg2, offset)			((instr) << 24 | (reg1) << 20 | (reg2) << 16 | ((offset) & OFFSET_MASK))
 
 /* number of registers */
-#define NUM_REGS 	0xF
+#define NUM_REGS 	0x10
+
+/* register which absorbs pre-decoded writes to the zero and stack length registers */
+#define SINK_REG	NUM_REGS
+
+/* use computed goto dispatch when the compiler supports it (define LVM_NO_THREADED to force the switch loop) */
+#if defined(__GNUC__) && !defined(LVM_NO_THREADED)
+#define LVM_THREADED
+#endif
+
+/* compile hot code to native code on x86-64 (define LVM_NO_JIT to leave the jit out) */
+#if defined(LVM_THREADED) && defined(__x86_64__) && !defined(_WIN32) && !defined(LVM_NO_JIT)
+#define LVM_JIT
+#endif
+
+/* amount of times a block has to be entered before the jit compiles it */
+#define JIT_THRESHOLD	0x100
+
+/* maximum amount of instructions in a compiled block */
+#define JIT_MAX_BLOCK	0x100
+
+/* size of the executable memory every vm may fill with compiled blocks */
+#define JIT_MEMORY_SIZE	0x100000
+
+/* initial capacity of the profiler's stack of routines being timed */
+#define PROF_INITIAL_FRAMES	0x40
+
+/* amount of locations listed in the profiler's hot spot report */
+#define PROF_HOT_SPOTS		0x20
+
+/* build the sampling profiler where setitimer and SIGPROF are available (define LVM_NO_SAMPLE to leave it out) */
+#if !defined(_WIN32) && !defined(LVM_NO_SAMPLE)
+#define LVM_SAMPLE
+#endif
+
+/* default rate of the sampling profiler in samples per second of cpu time (not round, so it does not run in lockstep
+ * with periodic work) */
+#define SAMPLE_RATE				997
+
+/* the sampling profiler keeps this many of the innermost frames of deeper call stacks */
+#define SAMPLE_MAX_DEPTH		0x200
+
+/* initial capacity of the sampling profiler's table of call stacks (a power of two) */
+#define SAMPLE_INITIAL_STACKS	0x100
+
+/* build the multi-threaded batch executor where pthreads are available (define LVM_NO_BATCH to leave it out) */
+#if !defined(_WIN32) && !defined(LVM_NO_BATCH)
+#define LVM_BATCH
+#endif
+
+/* maximum amount of batch jobs which may be queued or running before results have to be collected, per worker */
+#define BATCH_WINDOW_PER_WORKER	0x400
 
 /* size of each instruction in characters */
 #define INSTR_CHAR_LENGTH	0x8
 
+/* binary program container ("LVMB" when read as bytes, stored in host byte order) */
+#define LVMB_MAGIC		0x424D564C
+#define LVMB_VERSION	1
+
+/* extension used to select the binary container in lasm */
+#define LVMB_EXTENSION	".lvmb"
+
 struct lvm;
-struct lvm_jmp;
+struct lvm_calls;
 struct lvm_prg_ldr;
 struct lvm_cint;
 struct lvm_stack;
+struct lvm_jit;
+struct lvm_prof;
+struct lvm_sampler;
 
 /* word typedef */
 typedef unsigned int word_t;
@@ -91,41 +217,215 @@ typedef unsigned int word_t;
 /* c function type */
 typedef void(*lvm_cint_fn)(struct lvm*);
 
-// database for storing variables
+/* compiled block type (runs the vm from the block's entry and returns the location to continue interpreting at) */
+typedef size_t(*lvm_jit_fn)(struct lvm*);
+
+// pre-decoded instruction (built once when a program is loaded)
+typedef struct lvm_instr
+{
+	uint8_t op;				// opcode
+	uint8_t reg1;			// register argument 1
+	uint8_t reg2;			// register argument 2
+	uint8_t reg3;			// register argument 3
+	uint8_t reg4;			// register argument 4
+	intptr_t immd;			// immediate value (resolved to the width used by the opcode)
+} lvm_instr_t;
+
+// binary container header (every section offset is in bytes from the start of the file and 4 byte aligned)
+typedef struct lvm_bin_header
+{
+	uint32_t magic;			// LVMB_MAGIC
+	uint32_t version;		// LVMB_VERSION
+	uint32_t code_offset;	// offset of the code section (array of word_t)
+	uint32_t code_length;	// length of the code section in words
+	uint32_t data_offset;	// offset of the data section
+	uint32_t data_length;	// length of the data section in bytes
+	uint32_t sym_offset;	// offset of the symbol section (array of lvm_bin_sym_t)
+	uint32_t sym_count;		// amount of symbols
+	uint32_t str_offset;	// offset of the symbol name strings
+	uint32_t str_length;	// length of the symbol name strings in bytes
+} lvm_bin_header_t;
+
+// binary container symbol
+typedef struct lvm_bin_sym
+{
+	uint32_t pc;			// location of the label in the program
+	uint32_t name;			// offset of the null terminated name in the strings
+} lvm_bin_sym_t;
+
+// mapped binary container (every pointer points into the mapping)
+typedef struct lvm_bin
+{
+	void* base;						// start of the mapping (NULL if nothing is mapped)
+	size_t size;					// size of the mapping in bytes
+	const lvm_bin_header_t* header;	// container header
+	const word_t* code;				// code section
+	const uint8_t* data;			// data section
+	const lvm_bin_sym_t* symbols;	// symbol section
+	const char* strings;			// symbol name strings
+} lvm_bin_t;
+
+// database for storing variables (sized for the loaded program, so variable addresses stay valid while it runs)
 typedef struct lvm_database
 {
-	intptr_t values[MAX_VARIABLE_AMT];		// variable values
+	intptr_t* values;		// variable values
+	size_t length;			// amount of variables
 } lvm_database_t;
 
 // virtual stack
 typedef struct lvm_stack
 {
-	intptr_t values[MAX_STACK_DEPTH];		// stack values
-	size_t position;						// position in the stack (0 indexed)
+	intptr_t* values;		// stack values (NULL until the first push)
+	size_t position;		// position in the stack (0 indexed)
+	size_t capacity;		// amount of allocated values
+	size_t initial;			// capacity allocated on the first push
+	size_t max_depth;		// the stack never grows past this many values
 } lvm_stack_t;
 
-// c interface system
+// guest output buffer (flushed once full, when the program stops running and on request)
+typedef struct lvm_output
+{
+	char* data;				// buffered bytes (NULL until the first write)
+	size_t length;			// amount of buffered bytes
+	size_t capacity;		// size of data in bytes (0 until the first write)
+	size_t initial;			// capacity allocated on the first write (0 writes straight to the file)
+	FILE* file;				// file the output goes to
+} lvm_output_t;
+
+// guest input read ahead buffer
+typedef struct lvm_input
+{
+	char* data;				// bytes read ahead (NULL until the first read)
+	size_t position;		// position of the first byte which was not consumed yet
+	size_t length;			// amount of bytes in data
+	size_t capacity;		// size of data in bytes (0 until the first read)
+	size_t initial;			// capacity allocated on the first read
+	FILE* file;				// file the input comes from
+	int owns_file;			// whether the file was opened by the vm (and is closed with it)
+	int eof;				// whether the end of the file was reached
+} lvm_input_t;
+
+// c interface system (can be shared between vms)
 typedef struct lvm_cint
 {
-	int occupied[MAX_BIND_AMT];						// used to prevent 2 functions from being bound to the same id
-	lvm_cint_fn bound_functions[MAX_BIND_AMT];		// stores the bound functions in an array
+	lvm_cint_fn* bound_functions;	// bound functions indexed by id (NULL if nothing is bound to the id)
+	size_t capacity;				// amount of ids in bound_functions
 } lvm_cint_t;
 
+// vm creation parameters (zero fields use the defaults)
+typedef struct lvm_config
+{
+	size_t stack_capacity;		// capacity allocated on the first push (INITIAL_STACK_CAPACITY)
+	size_t max_stack_depth;		// maximum stack depth (MAX_STACK_DEPTH)
+	size_t call_capacity;		// capacity allocated on the first jsr (INITIAL_CALL_CAPACITY)
+	size_t max_call_depth;		// maximum call depth (MAX_CALL_DEPTH)
+	lvm_cint_t* cint;			// binding table shared with other vms (NULL to create one on the first bind)
+	int jit;					// whether hot code is compiled to native code (see lvm_setjit)
+	size_t output_capacity;		// size of the output buffer (OUTPUT_BUFFER_SIZE)
+	size_t input_capacity;		// initial size of the input buffer (INPUT_BUFFER_SIZE)
+} lvm_config_t;
+
 // program loader
 typedef struct lvm_prg_ldr
 {
 	FILE* input_file;	// input file pointer
-	char read_buf[9];	// buffer in which the instruction will be stored
-	int last_char;		// last character read
 } lvm_prg_ldr_t;
 
-// jump table
-typedef struct lvm_jmp
+// return address stack
+typedef struct lvm_calls
+{
+	size_t* return_pcs;		// locations to return to (NULL until the first call)
+	size_t depth;			// current call depth
+	size_t capacity;		// amount of allocated locations
+	size_t initial;			// capacity allocated on the first call
+	size_t max_depth;		// the call stack never grows past this many locations
+} lvm_calls_t;
+
+// loaded program (immutable once created, so it can be run by many vms at the same time)
+typedef struct lvm_image
+{
+	word_t* program;		// program words
+	size_t length;			// length of the code in words (the data section, if it is stored in the words, follows it)
+	lvm_instr_t* code;		// pre-decoded program (length + 1 entries, the last being a halt)
+	const uint8_t* data;	// read-only data section (string literals), NULL if the program has none
+	size_t data_length;		// length of the data section in bytes
+	size_t variables;		// amount of database entries the program uses
+	int should_free;		// whether the program words are freed with the image
+	lvm_bin_t bin;			// mapped binary container the program was read from (if any)
+	long refs;				// reference count (updated atomically)
+} lvm_image_t;
+
+// jit compiler state (per vm, built for the program the vm has loaded)
+typedef struct lvm_jit
+{
+	const lvm_instr_t* code;	// pre-decoded program the blocks are compiled from
+	size_t length;				// length of the program in words
+	uint32_t* counts;			// amount of times the block at each location was entered
+	lvm_jit_fn* blocks;			// compiled block at each location (NULL if none was compiled)
+	uint8_t* memory;			// executable memory holding the compiled blocks (NULL until the first compile)
+	size_t used;				// amount of bytes of memory in use
+	size_t capacity;			// size of memory in bytes (0 once it could not be allocated)
+} lvm_jit_t;
+
+// profile of a program location
+typedef struct lvm_prof_site
 {
-	size_t jmpfrom_locations[MAX_JUMP_DEPTH];	// locations jumped from
-	size_t jmpto_locations[MAX_JUMP_DEPTH];		// locations jumped to
-	size_t current_jmp_lvl;						// current jump lvl
-} lvm_jmp_t;
+	uint64_t count;			// amount of times the instruction at the location was executed
+	uint64_t calls;			// amount of times the routine at the location was called
+	uint64_t total;			// time spent in the routine at the location, including the routines it called (nanoseconds)
+	uint64_t self;			// time spent in the routine at the location itself (nanoseconds)
+	size_t active;			// amount of calls of the routine being timed (only the outermost one adds to total)
+} lvm_prof_site_t;
+
+// routine being timed by the profiler
+typedef struct lvm_prof_frame
+{
+	size_t entry;			// location of the routine
+	uint64_t start;			// time the routine was called at (nanoseconds)
+	uint64_t children;		// time spent in the routines it called so far (nanoseconds)
+} lvm_prof_frame_t;
+
+// execution profile (per vm, built for the program the vm has loaded)
+typedef struct lvm_prof
+{
+	size_t length;				// length of the program in words
+	uint64_t ops[256];			// executions per opcode (fused instructions are counted under their own opcode)
+	lvm_prof_site_t* sites;		// profile of every location (length + 1 entries, the last being the halt past the end)
+	lvm_prof_frame_t* frames;	// routines being timed, innermost last
+	size_t depth;				// amount of routines being timed
+	size_t capacity;			// amount of allocated frames
+	size_t untimed;				// amount of calls which could not be timed (the frames could not grow)
+	uint64_t elapsed;			// time spent running (nanoseconds)
+} lvm_prof_t;
+
+// call stack seen by the sampling profiler
+typedef struct lvm_sample_stack
+{
+	uint32_t hash;			// hash of the frames
+	size_t offset;			// offset of the frames in the frame pool (outermost first)
+	size_t depth;			// amount of frames (0 if the slot is empty)
+	uint64_t count;			// amount of samples which saw the stack
+} lvm_sample_stack_t;
+
+// sampling profile (per vm, every frame is the location of the label the location running in it belongs to)
+typedef struct lvm_sampler
+{
+	volatile sig_atomic_t pending;	// set by the timer signal when a sample is due
+	void* volatile table[256];		// dispatch table of the threaded loop while sampling
+	void* hook;						// handler the timer signal points the dispatch table at (NULL if none)
+	unsigned int rate;				// samples per second of cpu time
+	size_t* labels;					// locations of the labels of the program, in order (NULL if it has none)
+	size_t label_count;				// amount of label locations
+	lvm_sample_stack_t* stacks;		// call stacks seen so far (open addressing with linear probing)
+	size_t capacity;				// amount of slots (a power of two)
+	size_t length;					// amount of call stacks seen
+	size_t* frames;					// frame pool
+	size_t frame_length;			// amount of frames in use
+	size_t frame_capacity;			// amount of allocated frames
+	uint64_t samples;				// amount of samples taken
+	uint64_t truncated;				// amount of samples whose call stack was deeper than SAMPLE_MAX_DEPTH
+	uint64_t dropped;				// amount of samples which could not be stored
+} lvm_sampler_t;
 
 // machine struct
 typedef struct lvm
@@ -133,56 +433,206 @@ typedef struct lvm
 	size_t pc;				// program counter
 	intptr_t cmp1;			// comparison value 1
 	intptr_t cmp2;			// comparison value 2
-	intptr_t regs[NUM_REGS];		// registers for storing values
+	intptr_t regs[NUM_REGS + 1];	// registers for storing values (plus the write sink)
 	int instr_num;			// instruction argument
 	int reg1;				// register argument 1
 	int reg2;				// register argument 2
 	int reg3;				// register argument 3
 	int reg4;				// register argument 4
-	int immd;				// immediate value
-	int limd;				// long immediate value
-	word_t* program;		// halt-terminated program array
+	intptr_t immd;			// immediate value
+	intptr_t limd;			// long immediate value
+	lvm_image_t* image;		// loaded program image (the vm holds a reference to it)
+	const word_t* program;	// program words of the image
+	size_t length;			// length of the program in words
+	const lvm_instr_t* code;	// pre-decoded program of the image
+	const uint8_t* data;	// data section of the image
 	int current;			// current instruction
 	int running;			// is the vm running
 	int result;				// resulting value (i.e main return value)
-	int should_free;		// whether the program should be freed from memory upon completion
 	int debug;				// whether to debug the instructions
-	lvm_prg_ldr_t loader;	// program loader (from file)
-	lvm_jmp_t jmp_table;	// jump/branch table
-	lvm_cint_t cint;		// c interface module
+	int use_jit;			// whether to compile hot code to native code
+	lvm_jit_t* jit;			// jit compiler state (NULL until the jit first runs)
+	int profile;			// whether to profile the program while it runs
+	lvm_prof_t* prof;		// execution profile (NULL until the first profiled run)
+	unsigned int sample;	// samples per second of the sampling profiler (0 if it is off)
+	lvm_sampler_t* sampler;	// sampling profile (NULL until the first sampled run)
+	lvm_calls_t calls;		// return address stack
+	lvm_cint_t* cint;		// c interface module (NULL until something is bound)
+	int owns_cint;			// whether the c interface module was created by (and is freed with) this vm
 	lvm_stack_t stack;		// virtual stack instance
 	lvm_database_t db;		// database
+	lvm_output_t output;	// buffered guest output
+	lvm_input_t input;		// buffered guest input
 } lvm_t;
 
+#ifdef LVM_BATCH
+
+// batch job (one set of arguments to run the program with)
+typedef struct lvm_job
+{
+	size_t index;				// position of the job in the input
+	intptr_t* args;				// arguments, pushed onto the stack in order before the program runs
+	size_t argc;				// amount of arguments
+	int result;					// value the program halted with
+	struct lvm_job* next;		// next job in the results channel
+} lvm_job_t;
+
+// per-worker job queue (the owner takes the newest job, thieves take the oldest)
+typedef struct lvm_deque
+{
+	lvm_job_t** jobs;			// ring buffer of jobs
+	size_t head;				// index of the oldest job
+	size_t length;				// amount of jobs in the queue
+	size_t capacity;			// capacity of the ring buffer
+	pthread_mutex_t lock;		// guards the queue
+} lvm_deque_t;
+
+struct lvm_batch;
+
+// batch worker
+typedef struct lvm_worker
+{
+	struct lvm_batch* batch;	// batch the worker belongs to
+	size_t id;					// index of the worker (and of its queue)
+	lvm_t* vm;					// vm reused for every job the worker runs
+	pthread_t thread;			// worker thread
+} lvm_worker_t;
+
+// batch executor (a fixed pool of workers running one image over many jobs)
+typedef struct lvm_batch
+{
+	lvm_image_t* image;			// image every job runs
+	size_t workers;				// amount of workers
+	size_t started;				// amount of worker threads started
+	lvm_worker_t* pool;			// the workers
+	lvm_deque_t* queues;		// one job queue per worker
+	size_t next_queue;			// queue the next submitted job goes to
+	long queued;				// amount of jobs waiting in the queues (briefly negative while a submit is in flight)
+	size_t outstanding;			// amount of submitted jobs whose result has not been collected
+	int closing;				// set once no more jobs will be submitted
+	size_t sleeping;			// amount of workers waiting for jobs
+	int collecting;				// whether a thread is waiting for a result
+	pthread_mutex_t lock;		// guards queued, closing and the results channel
+	pthread_cond_t work;		// signalled when jobs are submitted or the batch closes
+	pthread_cond_t done;		// signalled when a result is available
+	lvm_job_t* results;			// finished jobs (results channel)
+	lvm_job_t* results_tail;	// last finished job
+} lvm_batch_t;
+
+int lvm_batch_stream(lvm_image_t *image,const lvm_config_t *config,size_t workers,FILE *input,FILE *output);
+void lvm_batch_destroy(lvm_batch_t *batch);
+lvm_job_t *lvm_batch_result(lvm_batch_t *batch);
+void lvm_batch_close(lvm_batch_t *batch);
+int lvm_batch_submit(lvm_batch_t *batch,lvm_job_t *job);
+lvm_batch_t *lvm_batch_create(lvm_image_t *image,const lvm_config_t *config,size_t workers);
+
+#endif
+
+void lvm_rewind(lvm_t *vm);
+void lvm_destroy(lvm_t *vm);
+lvm_t *lvm_create(const lvm_config_t *config);
 void lvm_close(lvm_t *vm);
 void lvm_push(lvm_t *vm, intptr_t value);
 intptr_t lvm_pop(lvm_t *vm);
 int lvm_run(lvm_t *vm);
 int lvm_read(lvm_t *vm,const char *filename);
-void lvm_load(lvm_t *vm,word_t *program,int should_free);
+void lvm_load(lvm_t *vm,word_t *program,size_t length,int should_free);
+int lvm_attach(lvm_t *vm,lvm_image_t *image);
+int lvm_openinput(lvm_t *vm,const char *filename);
+void lvm_setinput(lvm_t *vm,FILE *file);
+int lvm_flush(lvm_t *vm);
+void lvm_setoutput(lvm_t *vm,FILE *file);
+void lvm_setsample(lvm_t *vm,unsigned int rate);
+void lvm_setprof(lvm_t *vm,int value);
+void lvm_setjit(lvm_t *vm,int value);
 void lvm_setdbg(lvm_t *vm,int value);
 void lvm_reset(lvm_t *vm);
 void lvm_overbind(lvm_t *vm,lvm_cint_fn fn,size_t id);
 void lvm_bind(lvm_t *vm,lvm_cint_fn fn,size_t id);
 void lvm_eval(lvm_t *vm);
+void lvm_st(int op,void *address,intptr_t value);
+intptr_t lvm_ld(int op,const void *address);
+void lvm_run_switch(lvm_t *vm);
+#ifdef LVM_THREADED
+void lvm_run_threaded(lvm_t *vm);
+#endif
 void lvm_decode(lvm_t *vm);
+intptr_t lvm_wide_immediate(const word_t *program,size_t length,size_t pc);
+void lvm_decode_word(lvm_t *vm,word_t word);
 void lvm_fetch(lvm_t *vm);
+void lvm_init_config(lvm_t *vm,const lvm_config_t *config);
 void lvm_init(lvm_t *vm);
 
-void lvm_stack_push(lvm_stack_t *stack,intptr_t value);
+#ifdef LVM_JIT
+lvm_jit_fn lvm_jit_compile(lvm_jit_t *jit,size_t entry);
+void lvm_jit_destroy(lvm_jit_t *jit);
+lvm_jit_t *lvm_jit_create(const lvm_instr_t *code,size_t length);
+#endif
+
+void lvm_sample_report(lvm_t *vm,FILE *out);
+#ifdef LVM_SAMPLE
+void lvm_sample_stop(lvm_sampler_t *sampler);
+int lvm_sample_start(lvm_sampler_t *sampler);
+#endif
+void lvm_sample_record(lvm_sampler_t *sampler,const lvm_calls_t *calls,size_t pc);
+void lvm_sample_destroy(lvm_sampler_t *sampler);
+lvm_sampler_t *lvm_sample_create(const lvm_bin_t *bin,unsigned int rate);
+
+void lvm_prof_report(lvm_t *vm,FILE *out);
+void lvm_prof_finish(lvm_prof_t *prof);
+void lvm_prof_step(lvm_prof_t *prof,size_t pc,int op,size_t target);
+void lvm_prof_destroy(lvm_prof_t *prof);
+lvm_prof_t *lvm_prof_create(size_t length);
+const char *lvm_opname(int op);
+
+int lvm_fused_length(int op);
+int lvm_unfused(int op);
+void lvm_fuse(lvm_instr_t *code,size_t length);
+lvm_instr_t *lvm_predecode(const word_t *program,size_t length,size_t *variables);
+
+void lvm_image_release(lvm_image_t *image);
+lvm_image_t *lvm_image_retain(lvm_image_t *image);
+lvm_image_t *lvm_image_read(const char *filename);
+lvm_image_t *lvm_image_create(word_t *program,size_t length,int should_free);
+
+const char *lvm_input_record(lvm_input_t *input,char delimiter,size_t *length);
+size_t lvm_input_read(lvm_input_t *input,void *bytes,size_t length);
+void lvm_input_free(lvm_input_t *input);
+void lvm_input_init(lvm_input_t *input,size_t initial,FILE *file,int owns_file);
+
+int lvm_output_int(lvm_output_t *output,intptr_t value);
+int lvm_output_putc(lvm_output_t *output,char c);
+int lvm_output_write(lvm_output_t *output,const void *bytes,size_t length);
+int lvm_output_flush(lvm_output_t *output);
+void lvm_output_free(lvm_output_t *output);
+void lvm_output_init(lvm_output_t *output,size_t initial,FILE *file);
+
+int lvm_stack_push(lvm_stack_t *stack,intptr_t value);
 intptr_t lvm_stack_pop(lvm_stack_t *stack);
+void lvm_stack_free(lvm_stack_t *stack);
+void lvm_stack_init(lvm_stack_t *stack,size_t initial,size_t max_depth);
 
-size_t lvm_jmp_back(lvm_jmp_t *jmp,size_t pc);
-void lvm_jmp_jump(lvm_jmp_t *jmp,size_t current_pc,size_t new_pc);
-void lvm_jmp_init(lvm_jmp_t *jmp);
+size_t lvm_calls_pop(lvm_calls_t *calls,size_t fallback);
+int lvm_calls_push(lvm_calls_t *calls,size_t pc);
+void lvm_calls_free(lvm_calls_t *calls);
+void lvm_calls_init(lvm_calls_t *calls,size_t initial,size_t max_depth);
 
-word_t *lvm_prg_ldr_read(lvm_prg_ldr_t *ldr);
+int lvm_prg_ldr_map(lvm_prg_ldr_t *ldr,lvm_bin_t *bin);
+int lvm_prg_ldr_is_binary(lvm_prg_ldr_t *ldr);
+word_t *lvm_prg_ldr_read(lvm_prg_ldr_t *ldr,size_t *length);
+void lvm_prg_ldr_close(lvm_prg_ldr_t *ldr);
 int lvm_prg_ldr_loadf(lvm_prg_ldr_t *ldr,const char *filename);
 void lvm_prg_ldr_init(lvm_prg_ldr_t *ldr);
 
+const char *lvm_bin_symbol_name(const lvm_bin_t *bin,size_t index);
+void lvm_bin_unmap(lvm_bin_t *bin);
+void lvm_bin_init(lvm_bin_t *bin);
+
 void lvm_cint_call(lvm_cint_t *interface,lvm_t *vm,size_t id);
 int lvm_cint_overbind(lvm_cint_t *interface,lvm_cint_fn fn,size_t id);
 int lvm_cint_bind(lvm_cint_t *interface,lvm_cint_fn fn,size_t id);
-void lvm_cint_init(lvm_cint_t *interface);
+void lvm_cint_destroy(lvm_cint_t *interface);
+lvm_cint_t *lvm_builtins_create(void);
+lvm_cint_t *lvm_cint_create(void);
 
 #endif
\ No newline at end of file